@@ -0,0 +1,58 @@
+// Streaming throughput of a lambda system over anonymous vs memory-mapped tables. Pass a row count larger than RAM /
+// 64 bytes to see the mapped table page in from disk. Files go in the directory given as the second argument
+#include "ECS.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace whal::ecs;
+
+struct Row {
+    float v[16];
+};
+
+struct MappedRow {
+    float v[16];
+};
+
+template <>
+struct whal::ecs::StoragePolicy<MappedRow> {
+    using type = MappedStorage;
+};
+
+// MB/s for one update of a system reading every row
+template <typename T>
+double timeUpdate(u32 rowCount) {
+    World world(rowCount + 1);
+    float sum = 0;
+    world.system<T>("stream").each([&](Entity, T& row) {
+        sum += row.v[0];
+        row.v[1] += 1;
+    });
+    for (u32 i = 0; i < rowCount; i++) {
+        world.addComponent(world.entity(), T{{float(i)}});
+    }
+    world.flush();
+    world.update();  // first pass fills the page cache, or faults in the anonymous pages
+
+    auto start = std::chrono::steady_clock::now();
+    world.update();
+    auto end = std::chrono::steady_clock::now();
+    // keep the loop from being optimised away
+    if (sum == 1.5f) {
+        std::printf("!");
+    }
+    return rowCount * sizeof(T) / std::chrono::duration<double>(end - start).count() / 1e6;
+}
+
+int main(int argc, char** argv) {
+    const u32 rowCount = argc > 1 ? std::atoi(argv[1]) : 4000000;
+    if (argc > 2) {
+        MappedStorage::directory = argv[2];
+    }
+    std::printf("%u rows (%.0f MB)\n", rowCount, rowCount * sizeof(Row) / 1e6);
+    std::printf("anonymous: %6.0f MB/s\n", timeUpdate<Row>(rowCount));
+    std::printf("mapped:    %6.0f MB/s\n", timeUpdate<MappedRow>(rowCount));
+    return 0;
+}
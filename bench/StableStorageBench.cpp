@@ -0,0 +1,54 @@
+// Compares forEach over DenseStorage and StableStorage, with and without holes.
+#include "ECS.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+using namespace whal::ecs;
+
+struct Body {
+    float x, y, vx, vy;
+};
+
+constexpr u32 ENTITY_COUNT = 1000000;
+constexpr int REPS = 200;
+
+// microseconds per full pass
+template <typename Array>
+double timeForEach(Array& array) {
+    float sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < REPS; r++) {
+        array.forEach([&](Entity, Body& b) {
+            b.x += b.vx;
+            sum += b.x;
+        });
+    }
+    auto end = std::chrono::steady_clock::now();
+    // keep the loop from being optimised away
+    if (sum == 1234.5f) {
+        std::printf("!");
+    }
+    return std::chrono::duration<double, std::micro>(end - start).count() / REPS;
+}
+
+int main() {
+    ComponentArray<Body, DenseStorage> dense(ENTITY_COUNT + 1);
+    ComponentArray<Body, StableStorage> stable(ENTITY_COUNT + 1);
+    for (u32 i = 1; i <= ENTITY_COUNT; i++) {
+        dense.addData(Entity(i), Body{0, 0, 1, 0});
+        stable.addData(Entity(i), Body{0, 0, 1, 0});
+    }
+    std::printf("%u entities, full:      dense %8.0fus  stable %8.0fus\n", ENTITY_COUNT, timeForEach(dense), timeForEach(stable));
+
+    std::mt19937 rng(1);
+    for (u32 i = 1; i <= ENTITY_COUNT; i++) {
+        if (rng() % 4 == 0) {
+            dense.removeData(Entity(i));
+            stable.removeData(Entity(i));
+        }
+    }
+    std::printf("%u entities, 25%% holes: dense %8.0fus  stable %8.0fus\n", ENTITY_COUNT, timeForEach(dense), timeForEach(stable));
+    return 0;
+}
@@ -0,0 +1,29 @@
+#include "ECS.h"
+
+namespace whal::ecs {
+
+ArchetypeTable::ArchetypeTable() {
+    intern(Pattern());
+}
+
+ArchetypeID ArchetypeTable::intern(const Pattern& pattern) {
+    auto [it, isNew] = mPatternToArchetype.try_emplace(pattern, mPatterns.size());
+    if (isNew) {
+        mPatterns.push_back(pattern);
+    }
+    return it->second;
+}
+
+ArchetypeID ArchetypeTable::withComponent(ArchetypeID archetype, ComponentType type, bool isAdded) {
+    const u64 key = (static_cast<u64>(archetype) << 32) | (static_cast<u64>(type) << 1) | isAdded;
+    if (auto it = mEdges.find(key); it != mEdges.end()) {
+        return it->second;
+    }
+    Pattern pattern = mPatterns[archetype];
+    pattern.set(type, isAdded);
+    const ArchetypeID target = intern(pattern);
+    mEdges.emplace(key, target);
+    return target;
+}
+
+}  // namespace whal::ecs
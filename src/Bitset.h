@@ -0,0 +1,107 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+// Fixed-size bitset usable in constant expressions (std::bitset can't be modified at compile time until C++23).
+// Works on whole 64-bit words so subset tests compile down to a few ANDs
+template <size_t N>
+class Bitset {
+public:
+    constexpr Bitset() = default;
+
+    constexpr Bitset& set(size_t pos, bool value = true) {
+        if (value) {
+            mWords[pos / 64] |= bit(pos);
+        } else {
+            mWords[pos / 64] &= ~bit(pos);
+        }
+        return *this;
+    }
+
+    constexpr Bitset& reset(size_t pos) { return set(pos, false); }
+
+    constexpr Bitset& reset() {
+        for (size_t i = 0; i < WORD_COUNT; i++) {
+            mWords[i] = 0;
+        }
+        return *this;
+    }
+
+    constexpr bool test(size_t pos) const { return (mWords[pos / 64] & bit(pos)) != 0; }
+
+    constexpr bool any() const {
+        for (size_t i = 0; i < WORD_COUNT; i++) {
+            if (mWords[i] != 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    constexpr bool none() const { return !any(); }
+
+    constexpr size_t count() const {
+        size_t total = 0;
+        for (size_t i = 0; i < WORD_COUNT; i++) {
+            total += std::popcount(mWords[i]);
+        }
+        return total;
+    }
+
+    constexpr size_t size() const { return N; }
+
+    // true if every bit set in `other` is also set here
+    constexpr bool contains(const Bitset& other) const {
+        for (size_t i = 0; i < WORD_COUNT; i++) {
+            if ((mWords[i] & other.mWords[i]) != other.mWords[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // true if any bit is set in both
+    constexpr bool intersects(const Bitset& other) const {
+        for (size_t i = 0; i < WORD_COUNT; i++) {
+            if ((mWords[i] & other.mWords[i]) != 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    constexpr Bitset& operator&=(const Bitset& other) {
+        for (size_t i = 0; i < WORD_COUNT; i++) {
+            mWords[i] &= other.mWords[i];
+        }
+        return *this;
+    }
+
+    constexpr Bitset& operator|=(const Bitset& other) {
+        for (size_t i = 0; i < WORD_COUNT; i++) {
+            mWords[i] |= other.mWords[i];
+        }
+        return *this;
+    }
+
+    constexpr Bitset operator&(const Bitset& other) const { return Bitset(*this) &= other; }
+    constexpr Bitset operator|(const Bitset& other) const { return Bitset(*this) |= other; }
+    constexpr bool operator==(const Bitset& other) const = default;
+
+    size_t hash() const {
+        uint64_t h = 0;
+        for (size_t i = 0; i < WORD_COUNT; i++) {
+            h = (h ^ mWords[i]) * 0x100000001b3ull;
+        }
+        return h ^ (h >> 32);
+    }
+
+private:
+    static constexpr size_t WORD_COUNT = (N + 63) / 64;
+
+    static constexpr uint64_t bit(size_t pos) { return uint64_t(1) << (pos % 64); }
+
+    uint64_t mWords[WORD_COUNT] = {};
+};
@@ -0,0 +1,62 @@
+#include <algorithm>
+#include "ECS.h"
+
+namespace whal::ecs {
+
+CommandBuffer::~CommandBuffer() {
+    reset();
+}
+
+void CommandBuffer::activate(Entity entity) {
+    push(entity, [](World& world, Entity e, void*) { world.activate(e); }, nullptr, nullptr);
+}
+
+void CommandBuffer::deactivate(Entity entity) {
+    push(entity, [](World& world, Entity e, void*) { world.deactivate(e); }, nullptr, nullptr);
+}
+
+void CommandBuffer::kill(Entity entity) {
+    push(entity, [](World& world, Entity e, void*) { world.kill(e); }, nullptr, nullptr);
+}
+
+void* CommandBuffer::allocatePayload(size_t bytes, size_t alignment) {
+    assert(alignment <= alignof(std::max_align_t) && "Over-aligned components can't be recorded");
+    while (mBlockIx < mBlocks.size()) {
+        const size_t offset = (mOffset + alignment - 1) & ~(alignment - 1);
+        if (offset + bytes <= mBlocks[mBlockIx].size) {
+            mOffset = offset + bytes;
+            return reinterpret_cast<std::byte*>(mBlocks[mBlockIx].data.get()) + offset;
+        }
+        mBlockIx++;
+        mOffset = 0;
+    }
+    const size_t size = std::max(BLOCK_SIZE, bytes);
+    mBlocks.push_back({std::make_unique<std::max_align_t[]>((size + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t)), size});
+    mBlockIx = mBlocks.size() - 1;
+    mOffset = bytes;
+    return mBlocks.back().data.get();
+}
+
+void CommandBuffer::apply(World& world) {
+    // by index, since callbacks may record more commands. Payloads never move, so those are applied in this pass too
+    for (size_t i = 0; i < mCommands.size(); i++) {
+        const Command command = mCommands[i];
+        command.apply(world, command.entity, command.payload);
+    }
+    mCommands.clear();
+    mBlockIx = 0;
+    mOffset = 0;
+}
+
+void CommandBuffer::reset() {
+    for (const Command& command : mCommands) {
+        if (command.destroy) {
+            command.destroy(command.payload);
+        }
+    }
+    mCommands.clear();
+    mBlockIx = 0;
+    mOffset = 0;
+}
+
+}  // namespace whal::ecs
@@ -1,8 +1,10 @@
+#include <unistd.h>
+#include <cctype>
 #include "ECS.h"
 
 namespace whal::ecs {
 
-ComponentManager::ComponentManager() {
+ComponentManager::ComponentManager(u32 capacity) : mCapacity(capacity) {
     mComponentToIndex.fill(-1);
 }
 
@@ -18,10 +20,84 @@ void ComponentManager::entityDestroyed(const Entity entity) {
     }
 }
 
+void ComponentManager::entityDestroyed(std::span<const Entity> entities, JobPool& pool) {
+    // arrays don't share any state, so each one handles the whole batch on its own job. Small batches aren't worth it
+    auto removeFromArray = [&](u32 ix) {
+        for (Entity entity : entities) {
+            mComponentArrays[ix]->entityDestroyed(entity);
+        }
+    };
+    if (entities.size() < PARALLEL_DESTROY_THRESHOLD) {
+        for (u32 ix = 0; ix < mComponentArrays.size(); ix++) {
+            removeFromArray(ix);
+        }
+        return;
+    }
+    pool.parallelFor(mComponentArrays.size(), removeFromArray);
+}
+
+void ComponentManager::clear() {
+    for (auto const& componentArray : mComponentArrays) {
+        componentArray->clear();
+    }
+}
+
+void ComponentManager::setCapacity(u32 capacity) {
+    // arrays size their storage on construction. Registrations (and so component indices) stay the same
+    mCapacity = capacity;
+    for (size_t ix = 0; ix < mComponentArrays.size(); ix++) {
+        delete mComponentArrays[ix];
+        mComponentArrays[ix] = mArrayFactories[ix](capacity);
+    }
+}
+
+void ComponentManager::hibernate(const std::vector<Entity>& entities) {
+    for (auto const& componentArray : mComponentArrays) {
+        componentArray->hibernate(entities.data(), entities.size());
+    }
+}
+
+void ComponentManager::wake(const std::vector<Entity>& entities) {
+    for (auto const& componentArray : mComponentArrays) {
+        componentArray->wake(entities.data(), entities.size());
+    }
+}
+
+void ComponentManager::flush() {
+    for (auto const& componentArray : mComponentArrays) {
+        componentArray->flush();
+    }
+}
+
 void ComponentManager::copyComponents(const Entity prefab, Entity dest) {
     for (auto const& componentArray : mComponentArrays) {
         componentArray->copyComponent(prefab, dest);
     }
 }
 
+void ComponentManager::copyComponents(const std::vector<Entity>& prefabs, const std::vector<Entity>& dests) {
+    assert(prefabs.size() == dests.size());
+    for (auto const& componentArray : mComponentArrays) {
+        componentArray->copyComponents(prefabs.data(), dests.data(), prefabs.size());
+    }
+}
+
+void ComponentManager::moveComponents(const std::vector<Entity>& src, const std::vector<Entity>& dst, ComponentManager& dstManager) {
+    assert(src.size() == dst.size());
+    for (auto const& componentArray : mComponentArrays) {
+        componentArray->moveComponents(src.data(), dst.data(), src.size(), dstManager);
+    }
+}
+
+std::string mappedStoragePath(std::string_view typeName) {
+    static std::atomic<u32> counter = 0;  // several worlds can map the same type
+    std::string name(typeName);
+    for (char& c : name) {
+        if (!std::isalnum(static_cast<unsigned char>(c))) {
+            c = '_';
+        }
+    }
+    return MappedStorage::directory + "/" + name + "." + std::to_string(getpid()) + "." + std::to_string(counter++);
+}
+
 }  // namespace whal::ecs
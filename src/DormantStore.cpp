@@ -0,0 +1,110 @@
+#include "DormantStore.h"
+
+#include <cassert>
+#include <cstring>
+
+namespace whal::ecs {
+
+static void putVarint(std::vector<u8>& out, u32 value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<u8>(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(static_cast<u8>(value));
+}
+
+static u32 getVarint(const u8*& in) {
+    u32 value = 0;
+    for (u32 shift = 0;; shift += 7) {
+        const u8 byte = *in++;
+        value |= static_cast<u32>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+}
+
+DormantStore::DormantStore(u32 capacity, u32 rowSize) : mRowSize(rowSize), mRefs(capacity * sizeof(Ref)) {}
+
+void DormantStore::store(u32 id, const void* row) {
+    assert(!contains(id) && "Row is already dormant");
+    const u8* bytes = static_cast<const u8*>(row);
+    if (mBaseline.empty()) {
+        mBaseline.assign(bytes, bytes + mRowSize);
+    }
+
+    const size_t begin = mArena.size();
+    u32 i = 0;
+    while (i < mRowSize) {
+        const u32 zeroStart = i;
+        while (i < mRowSize && bytes[i] == mBaseline[i]) {
+            i++;
+        }
+        const u32 literalStart = i;
+        while (i < mRowSize && bytes[i] != mBaseline[i]) {
+            i++;
+        }
+        putVarint(mArena, literalStart - zeroStart);
+        putVarint(mArena, i - literalStart);
+        for (u32 j = literalStart; j < i; j++) {
+            mArena.push_back(bytes[j] ^ mBaseline[j]);
+        }
+    }
+    refs()[id] = {static_cast<u32>(begin), static_cast<u32>(mArena.size() - begin) + 1};
+}
+
+void DormantStore::load(u32 id, void* row) {
+    assert(contains(id) && "Row isn't dormant");
+    u8* bytes = static_cast<u8*>(row);
+    const u8* in = mArena.data() + refs()[id].offset;
+    u32 i = 0;
+    while (i < mRowSize) {
+        const u32 zeroCount = getVarint(in);
+        const u32 literalCount = getVarint(in);
+        std::memcpy(bytes + i, mBaseline.data() + i, zeroCount);
+        i += zeroCount;
+        for (u32 j = 0; j < literalCount; j++, i++) {
+            bytes[i] = *in++ ^ mBaseline[i];
+        }
+    }
+    erase(id);
+}
+
+void DormantStore::erase(u32 id) {
+    if (!contains(id)) {
+        return;
+    }
+    mGarbage += refs()[id].size - 1;
+    refs()[id] = {0, 0};
+
+    // waking entities leaves holes, so repack once they're most of the arena
+    if (mGarbage > 4096 && mGarbage * 2 > mArena.size()) {
+        compact();
+    }
+}
+
+void DormantStore::clear() {
+    mBaseline.clear();
+    mArena = {};
+    mGarbage = 0;
+    mRefs.release();
+}
+
+void DormantStore::compact() {
+    std::vector<u8> packed;
+    packed.reserve(mArena.size() - mGarbage);
+    const u32 capacity = mRefs.size() / sizeof(Ref);
+    for (u32 id = 0; id < capacity; id++) {
+        Ref& ref = refs()[id];
+        if (ref.size == 0) {
+            continue;
+        }
+        const u32 offset = packed.size();
+        packed.insert(packed.end(), mArena.begin() + ref.offset, mArena.begin() + ref.offset + ref.size - 1);
+        ref.offset = offset;
+    }
+    mArena = std::move(packed);
+    mGarbage = 0;
+}
+
+}  // namespace whal::ecs
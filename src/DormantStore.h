@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "ZeroedBuffer.h"
+
+typedef uint8_t u8;
+typedef uint32_t u32;
+
+namespace whal::ecs {
+
+// Compressed storage for the components of dormant entities, one fixed-size row per entity. Each row is XORed with a
+// baseline row (the first one stored), and the result is run-length encoded as varint (zero run, literal run) pairs.
+// Rows which mostly match the baseline shrink to a few bytes
+class DormantStore {
+public:
+    DormantStore(u32 capacity, u32 rowSize);
+
+    bool contains(u32 id) const { return refs()[id].size != 0; }
+    void store(u32 id, const void* row);
+    void load(u32 id, void* row);  // decompresses the row into `row` and removes it from the store
+    void erase(u32 id);
+    void clear();
+
+    size_t compressedSize() const { return mArena.size() - mGarbage; }
+
+private:
+    struct Ref {
+        u32 offset;
+        u32 size;  // encoded size + 1, so 0 means "not stored"
+    };
+
+    Ref* refs() const { return static_cast<Ref*>(mRefs.data()); }
+    void compact();
+
+    u32 mRowSize;
+    std::vector<u8> mBaseline;  // empty until the first row is stored
+    std::vector<u8> mArena;
+    size_t mGarbage = 0;  // bytes of mArena belonging to rows which were loaded or erased
+    ZeroedBuffer mRefs;
+};
+
+}  // namespace whal::ecs
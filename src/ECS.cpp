@@ -2,16 +2,26 @@
 
 namespace whal::ecs {
 
-World::World() : mEntityManager(new EntityManager), mComponentManager(new ComponentManager), mSystemManager(new SystemManager) {}
+World::World(u32 capacity)
+    : mArchetypes(new ArchetypeTable), mFrameAllocator(new FrameAllocator), mEntityManager(new EntityManager(*mArchetypes, capacity)),
+      mComponentManager(new ComponentManager(capacity)), mSystemManager(new SystemManager(*this, *mArchetypes)) {}
 
 World::~World() {
+    // systems are owned by the SystemManager, and ISystem entity sets are static so they'd outlive this world
+    mSystemManager->clear();
     delete mEntityManager;
     delete mComponentManager;
     delete mSystemManager;
+    delete mArchetypes;
+    delete mFrameAllocator;
 }
 
 Entity World::entity(bool isActive) const {
-    Entity e = mEntityManager->createEntity(isActive, mRootEntity);
+    return entityInPartition(0, isActive);
+}
+
+Entity World::entityInPartition(u32 partition, bool isActive) const {
+    Entity e = mEntityManager->createEntity(isActive, mRootEntity, partition);
     if (e.isValid() && mCreateCallback) {
         mCreateCallback(e);
     }
@@ -20,64 +30,251 @@ Entity World::entity(bool isActive) const {
 
 // works for inactive entities too, trust me
 void World::kill(Entity entity) {
-    mToKill.insert(entity);
+    {
+        KillQueue& queue = mToKill[partitionOf(entity)];
+        std::unique_lock<std::mutex> lock{queue.mutex};
+        queue.entities.insert(entity);
+    }
 
     // recursively kill child entities
-    for (Entity child : mEntityManager->parentToChildren[entity]) {
+    for (Entity child : mEntityManager->getChildren(entity)) {
         kill(child);
     }
 }
 
 void World::killEntities() {
-    while (!mToKill.empty()) {
-        // copy mToKill in case onRemove callbacks kill more entities
-        auto tmpToKill = std::move(mToKill);
-        mToKill.clear();
-        for (auto entityToKill : tmpToKill) {
+    FrameVector<Entity> toKill(scratchAllocator<Entity>());
+    std::array<size_t, MAX_PARTITIONS + 1> partitionEnds;  // toKill is grouped by partition
+    while (true) {
+        // take everything queued so far, in case onRemove callbacks kill more entities
+        toKill.clear();
+        for (u32 partition = 0; partition < getPartitionCount(); partition++) {
+            KillQueue& queue = mToKill[partition];
+            std::unique_lock<std::mutex> lock{queue.mutex};
+            toKill.insert(toKill.end(), queue.entities.begin(), queue.entities.end());
+            queue.entities.clear();
+            partitionEnds[partition] = toKill.size();
+        }
+        if (toKill.empty()) {
+            return;
+        }
+
+        FrameVector<SystemManager::ArchetypeChange> leaving(scratchAllocator<SystemManager::ArchetypeChange>());
+        for (Entity entityToKill : toKill) {
             if (mDeathCallback) {
                 mDeathCallback(entityToKill);
             }
-            mSystemManager->onEntityDestroyed(entityToKill);  // this goes first so onRemove can fetch components before
-                                                              // they're deallocated
+            if (isActive(entityToKill)) {
+                leaving.push_back({entityToKill, mEntityManager->getArchetype(entityToKill), SystemManager::INACTIVE});
+            }
+        }
+
+        // this goes first so onRemove can fetch components before they're deallocated
+        mSystemManager->onEntitiesChanged(leaving);
+        for (Entity entityToKill : toKill) {
             unparent(entityToKill);
+        }
+
+        // components go before the IDs are recycled, so a new entity never sees stale data
+        mComponentManager->entityDestroyed(toKill, getJobPool());
+        for (Entity entityToKill : toKill) {
             mEntityManager->destroyEntity(entityToKill);
-            mComponentManager->entityDestroyed(entityToKill);
         }
 
         // remove any redundant kills
-        for (auto entityToKill : tmpToKill) {
-            mToKill.erase(entityToKill);
+        size_t begin = 0;
+        for (u32 partition = 0; partition < getPartitionCount(); partition++) {
+            KillQueue& queue = mToKill[partition];
+            std::unique_lock<std::mutex> lock{queue.mutex};
+            for (size_t i = begin; i < partitionEnds[partition]; i++) {
+                queue.entities.erase(toKill[i]);
+            }
+            begin = partitionEnds[partition];
         }
     }
 }
 
 Entity World::copy(Entity prefab, bool isActive) const {
-    Entity newEntity = entity(false);
+    assert(!mEntityManager->isDormant(prefab) && "Cannot copy a dormant entity");
+    Entity newEntity = entityInPartition(partitionOf(prefab), false);
     if (!newEntity.isValid()) {
         return newEntity;
     }
     mComponentManager->copyComponents(prefab, newEntity);
-    mEntityManager->setPattern(newEntity, mEntityManager->getPattern(prefab));
+    mEntityManager->setArchetype(newEntity, mEntityManager->getArchetype(prefab));
 
     // copy prefab's parent
-    mEntityManager->childToParent[newEntity] = mEntityManager->childToParent[prefab];
-    mEntityManager->parentToChildren[mEntityManager->childToParent[newEntity]].insert(newEntity);
+    mEntityManager->setParent(newEntity, mEntityManager->getParent(prefab));
 
     if (isActive) {
-        newEntity.activate();
+        activate(newEntity);
     }
 
     return newEntity;
 }
 
+Entity World::copyTree(Entity root, bool isActive) const {
+    // gather the subtree, parents before children
+    std::vector<Entity> prefabs = {root};
+    std::vector<u32> parentIx = {0};  // index of each prefab's parent in `prefabs`
+    for (u32 i = 0; i < prefabs.size(); i++) {
+        assert(!mEntityManager->isDormant(prefabs[i]) && "Cannot copy a dormant entity");
+        for (Entity child : mEntityManager->getChildren(prefabs[i])) {
+            prefabs.push_back(child);
+            parentIx.push_back(i);
+        }
+    }
+
+    // reserve every ID first so a full world doesn't leave us with half a tree
+    std::vector<Entity> copies;
+    copies.reserve(prefabs.size());
+    for (u32 i = 0; i < prefabs.size(); i++) {
+        const Entity parent = i == 0 ? mEntityManager->getParent(root) : copies[parentIx[i]];
+        Entity copy = mEntityManager->createEntity(false, parent, i == 0 ? partitionOf(root) : partitionOf(copies[0]));
+        if (!copy.isValid()) {
+            for (auto it = copies.rbegin(); it != copies.rend(); ++it) {
+                mEntityManager->destroyEntity(*it);
+            }
+            return Entity();
+        }
+        copies.push_back(copy);
+    }
+
+    if (mCreateCallback) {
+        mCreateCallback(copies[0]);
+    }
+    if (mChildCreateCallback) {
+        for (u32 i = 1; i < copies.size(); i++) {
+            mChildCreateCallback(copies[i], copies[parentIx[i]]);
+        }
+    }
+
+    mComponentManager->copyComponents(prefabs, copies);
+    for (u32 i = 0; i < copies.size(); i++) {
+        mEntityManager->setArchetype(copies[i], mEntityManager->getArchetype(prefabs[i]));
+    }
+
+    // single membership update per entity, once all components are in place
+    if (isActive) {
+        std::vector<SystemManager::ArchetypeChange> joining;
+        joining.reserve(copies.size());
+        for (Entity copy : copies) {
+            if (mEntityManager->activate(copy)) {
+                joining.push_back({copy, SystemManager::INACTIVE, mEntityManager->getArchetype(copy)});
+            }
+        }
+        mSystemManager->onEntitiesChanged(joining);
+    }
+
+    return copies[0];
+}
+
+Entity World::migrate(Entity entity, World& dst) {
+    return migrate(std::vector<Entity>{entity}, dst)[0];
+}
+
+std::vector<Entity> World::migrate(const std::vector<Entity>& entities, World& dst) {
+    assert(&dst != this && "Cannot migrate entities into the same world");
+
+    // gather every subtree, parents before children
+    std::vector<Entity> sources;
+    std::unordered_map<Entity, Entity, EntityHash> srcToDst;
+    for (Entity root : entities) {
+        if (srcToDst.contains(root)) {
+            continue;
+        }
+        const size_t begin = sources.size();
+        sources.push_back(root);
+        srcToDst[root] = Entity();
+        for (size_t i = begin; i < sources.size(); i++) {
+            assert(!mEntityManager->isDormant(sources[i]) && "Cannot migrate a dormant entity");
+            for (Entity child : mEntityManager->getChildren(sources[i])) {
+                if (!srcToDst.contains(child)) {
+                    sources.push_back(child);
+                    srcToDst[child] = Entity();
+                }
+            }
+        }
+    }
+
+    // reserve IDs in the destination first so a full world doesn't leave us half-migrated
+    std::vector<Entity> targets;
+    targets.reserve(sources.size());
+    for (Entity src : sources) {
+        const u32 partition = partitionOf(src) < dst.getPartitionCount() ? partitionOf(src) : 0;
+        Entity target = dst.mEntityManager->createEntity(false, dst.mRootEntity, partition);
+        if (!target.isValid()) {
+            for (Entity created : targets) {
+                dst.unparent(created);
+                dst.mEntityManager->destroyEntity(created);
+            }
+            return std::vector<Entity>(entities.size());
+        }
+        srcToDst[src] = target;
+        targets.push_back(target);
+    }
+
+    // leave our systems while the components are still here so onRemove can read them
+    std::vector<bool> wasActive(sources.size());
+    std::vector<SystemManager::ArchetypeChange> leaving;
+    for (size_t i = 0; i < sources.size(); i++) {
+        wasActive[i] = isActive(sources[i]);
+        if (wasActive[i]) {
+            leaving.push_back({sources[i], mEntityManager->getArchetype(sources[i]), SystemManager::INACTIVE});
+        }
+    }
+    mSystemManager->onEntitiesChanged(leaving);
+
+    mComponentManager->moveComponents(sources, targets, *dst.mComponentManager);
+
+    for (size_t i = 0; i < sources.size(); i++) {
+        dst.mEntityManager->setPattern(targets[i], mEntityManager->getPattern(sources[i]));
+
+        if (auto it = srcToDst.find(mEntityManager->getParent(sources[i])); it != srcToDst.end()) {
+            dst.mEntityManager->setParent(targets[i], it->second);
+        }
+    }
+
+    for (Entity src : sources) {
+        {
+            // the ID is about to be recycled, so a pending kill would hit the wrong entity
+            KillQueue& queue = mToKill[partitionOf(src)];
+            std::unique_lock<std::mutex> lock{queue.mutex};
+            queue.entities.erase(src);
+        }
+        unparent(src);
+        mEntityManager->destroyEntity(src);
+    }
+
+    // single membership update in the destination, once all components are in place
+    std::vector<SystemManager::ArchetypeChange> joining;
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (wasActive[i] && dst.mEntityManager->activate(targets[i])) {
+            joining.push_back({targets[i], SystemManager::INACTIVE, dst.mEntityManager->getArchetype(targets[i])});
+        }
+    }
+    dst.mSystemManager->onEntitiesChanged(joining);
+
+    std::vector<Entity> migrated;
+    migrated.reserve(entities.size());
+    for (Entity root : entities) {
+        migrated.push_back(srcToDst[root]);
+    }
+    return migrated;
+}
+
 void World::activate(Entity entity) const {
+    if (mEntityManager->isDormant(entity)) {
+        // components have to be back in place before systems see the entity
+        mComponentManager->wake({entity});
+        mEntityManager->setDormant(entity, false);
+    }
     if (mEntityManager->activate(entity)) {
-        auto pattern = mEntityManager->getPattern(entity);
-        mSystemManager->onEntityPatternChanged(entity, pattern);
+        mSystemManager->onEntityActivated(entity, mEntityManager->getArchetype(entity));
     }
 
     // recursively activate children
-    for (Entity child : mEntityManager->parentToChildren[entity]) {
+    for (Entity child : mEntityManager->getChildren(entity)) {
         activate(child);
     }
 }
@@ -85,15 +282,62 @@ void World::activate(Entity entity) const {
 void World::deactivate(Entity entity) const {
     // remove from systems but keep in entity manager and component manager
     if (mEntityManager->deactivate(entity)) {
-        mSystemManager->onEntityDestroyed(entity);
+        mSystemManager->onEntityDestroyed(entity, mEntityManager->getArchetype(entity));
     }
 
     // recursively deactivate children
-    for (Entity child : mEntityManager->parentToChildren[entity]) {
+    for (Entity child : mEntityManager->getChildren(entity)) {
         deactivate(child);
     }
 }
 
+void World::collectSubtrees(const std::vector<Entity>& roots, std::vector<Entity>& out) const {
+    for (Entity root : roots) {
+        const size_t begin = out.size();
+        out.push_back(root);
+        for (size_t i = begin; i < out.size(); i++) {
+            for (Entity child : mEntityManager->getChildren(out[i])) {
+                out.push_back(child);
+            }
+        }
+    }
+}
+
+void World::hibernate(const std::vector<Entity>& entities) const {
+    for (Entity root : entities) {
+        deactivate(root);
+    }
+
+    std::vector<Entity> subtrees;
+    collectSubtrees(entities, subtrees);
+    std::vector<Entity> dormant;
+    dormant.reserve(subtrees.size());
+    for (Entity entity : subtrees) {
+        if (!mEntityManager->isDormant(entity)) {
+            mEntityManager->setDormant(entity, true);
+            dormant.push_back(entity);
+        }
+    }
+    mComponentManager->hibernate(dormant);
+}
+
+void World::activate(const std::vector<Entity>& entities) const {
+    std::vector<Entity> subtrees;
+    collectSubtrees(entities, subtrees);
+    std::vector<Entity> dormant;
+    for (Entity entity : subtrees) {
+        if (mEntityManager->isDormant(entity)) {
+            mEntityManager->setDormant(entity, false);
+            dormant.push_back(entity);
+        }
+    }
+    mComponentManager->wake(dormant);
+
+    for (Entity root : entities) {
+        activate(root);
+    }
+}
+
 u32 World::getEntityCount() const {
     return mEntityManager->getEntityCount();
 }
@@ -114,18 +358,30 @@ void World::setEntityAdoptCallback(EntityPairCallback callback) {
     mAdoptCallback = callback;
 }
 
+void World::setPartitionCount(u32 count) {
+    mEntityManager->setPartitionCount(count);
+}
+
+void World::setCapacity(u32 capacity) {
+    assert(getEntityCount() == 0 && "Cannot change the capacity of a world with living entities");
+    const u32 partitionCount = getPartitionCount();
+    delete mEntityManager;
+    mEntityManager = new EntityManager(*mArchetypes, capacity);
+    mEntityManager->setPartitionCount(partitionCount);
+
+    // systems keep a reference to the component manager, so it stays and rebuilds its arrays instead
+    mComponentManager->setCapacity(capacity);
+}
+
 void World::addChild(Entity parent, Entity child) const {
-    Entity oldParent = mEntityManager->childToParent[child];
-    mEntityManager->childToParent[child] = parent;
-    mEntityManager->parentToChildren[oldParent].erase(child);
-    mEntityManager->parentToChildren[parent].insert(child);
+    mEntityManager->setParent(child, parent);
     if (parent.isValid() && child.isValid() && mAdoptCallback) {
         mAdoptCallback(child, parent);
     }
 }
 
 Entity World::createChild(Entity parent, bool isActive) const {
-    Entity e = mEntityManager->createEntity(isActive, parent);
+    Entity e = mEntityManager->createEntity(isActive, parent, partitionOf(parent));
     if (e.isValid() && mChildCreateCallback) {
         mChildCreateCallback(e, parent);
     }
@@ -133,45 +389,69 @@ Entity World::createChild(Entity parent, bool isActive) const {
 }
 
 void World::orphan(Entity e) const {
-    Entity oldParent = mEntityManager->childToParent[e];
-    if (oldParent == mRootEntity) {
+    if (mEntityManager->getParent(e) == mRootEntity) {
         // cannot orphan top-level parent
         return;
     }
-
-    mEntityManager->childToParent[e] = mRootEntity;
-
-    // there are no guarantees on which order parents/children are deleted if the deletes happen on the same frame.
-    // BUT i don't think I touch a parent's list of children when it dies, so this should be fine?
-    mEntityManager->parentToChildren[oldParent].erase(e);
-    mEntityManager->parentToChildren[mRootEntity].insert(e);
+    mEntityManager->setParent(e, mRootEntity);
 }
 
 void World::unparent(Entity e) const {
-    Entity oldParent = mEntityManager->childToParent[e];
-    mEntityManager->childToParent.erase(e);
-    mEntityManager->parentToChildren[oldParent].erase(e);
+    mEntityManager->detach(e);
 }
 
 void World::forChild(Entity e, EntityCallback callback, bool isRecursive) const {
     if (isRecursive) {
-        for (const Entity& child : mEntityManager->parentToChildren[e]) {
+        for (const Entity& child : mEntityManager->getChildren(e)) {
             callback(child);
             forChild(child, callback, true);
         }
     } else {
-        for (const Entity& child : mEntityManager->parentToChildren[e]) {
+        for (const Entity& child : mEntityManager->getChildren(e)) {
             callback(child);
         }
     }
 }
 
 Entity World::parent(Entity e) const {
-    return mEntityManager->childToParent[e];
+    return mEntityManager->getParent(e);
 }
 
-const std::unordered_set<Entity, EntityHash>& World::children(Entity e) const {
-    return mEntityManager->parentToChildren[e];
+ChildRange World::children(Entity e) const {
+    return mEntityManager->getChildren(e);
+}
+
+u32 World::depth(Entity e) const {
+    return mEntityManager->getDepth(e);
+}
+
+void World::render() {
+    std::unique_lock<std::mutex> lock{mRenderMutex};
+    mIsRendering.store(true, std::memory_order_relaxed);
+    mSystemManager->runPhase(Phase::Render);
+    mIsRendering.store(false, std::memory_order_relaxed);
+}
+
+void World::resetFrameAllocator() {
+    // the Render phase may be using frame memory on another thread
+    std::unique_lock<std::mutex> lock{mRenderMutex};
+    mFrameAllocator->reset();
+}
+
+void World::runPhase(Phase phase) {
+    assert(phase != Phase::Render && "Use World::render for the render phase");
+    mSystemManager->runPhase(phase);
+
+    // sync point. Rendering may still be reading entities changed or killed this phase
+    std::unique_lock<std::mutex> lock{mRenderMutex};
+    applyCommands();
+    killEntities();
+}
+
+void World::applyCommands() {
+    for (u32 partition = 0; partition < getPartitionCount(); partition++) {
+        mCommandBuffers[partition].apply(*this);
+    }
 }
 
 bool World::isActive(Entity entity) const {
@@ -179,13 +459,20 @@ bool World::isActive(Entity entity) const {
 }
 
 void World::clear() {
+    const u32 partitionCount = getPartitionCount();
+    const u32 capacity = getCapacity();
     mSystemManager->clear();
     delete mEntityManager;
-    delete mComponentManager;
-    mToKill.clear();
+    mComponentManager->clear();
+    for (KillQueue& queue : mToKill) {
+        queue.entities.clear();
+    }
+    for (CommandBuffer& commands : mCommandBuffers) {
+        commands.reset();
+    }
 
-    mEntityManager = new EntityManager;
-    mComponentManager = new ComponentManager;
+    mEntityManager = new EntityManager(*mArchetypes, capacity);
+    mEntityManager->setPartitionCount(partitionCount);
 }
 
 }  // namespace whal::ecs
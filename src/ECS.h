@@ -1,21 +1,38 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
 #include <bitset>
 #include <cassert>
 #include <concepts>
+#include <cstring>
+#include <deque>
+#include <memory>
 #include <mutex>
+#include <new>
 #include <optional>
 #include <queue>
+#include <tuple>
+#include <span>
 #include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
+#include "Bitset.h"
+#include "DormantStore.h"
+#include "FrameAllocator.h"
+#include "JobPool.h"
 #include "Traits.h"
+#include "TypeName.h"
+#include "ZeroedBuffer.h"
 
 typedef uint16_t u16;
 typedef uint32_t u32;
+typedef uint64_t u64;
 
 namespace whal::gfx {
 struct EntityRenderInfo;
@@ -23,6 +40,7 @@ struct RenderContext;
 class RenderQueue;
 }  // namespace whal::gfx
 
+// default entity capacity of a World. Storage is reserved up front but only backed by memory once it's used
 #ifndef MAX_ENTITIES
 #define MAX_ENTITIES 5000
 #endif
@@ -31,17 +49,32 @@ class RenderQueue;
 #define MAX_COMPONENTS 64
 #endif
 
+// component IDs [0, MAX_STATIC_COMPONENTS) are reserved for StaticComponentID, the rest are handed out at runtime
+#ifndef MAX_STATIC_COMPONENTS
+#define MAX_STATIC_COMPONENTS (MAX_COMPONENTS / 4)
+#endif
+
+#ifndef MAX_PARTITIONS
+#define MAX_PARTITIONS 16
+#endif
+
 namespace whal::ecs {
 
 class EntityManager;
+class ComponentManager;
 class SystemManager;
+class World;
 
 using EntityID = u32;
 using ComponentType = u16;
-using Pattern = std::bitset<MAX_COMPONENTS>;
+using Pattern = Bitset<MAX_COMPONENTS>;
 using SystemId = u16;
+using ArchetypeID = u32;
 
 class Entity;
+class ChildRange;
+template <typename T>
+struct ColdPart;
 struct EntityHash;
 using EntityCallback = void (*)(Entity);
 using EntityPairCallback = void (*)(Entity, Entity);
@@ -77,10 +110,15 @@ public:
     template <typename T>
     T& get() const;
 
+    // the rarely used part of a T component, see ColdPart
+    template <typename T>
+    typename ColdPart<T>::type& getCold() const;
+
     template <typename T>
     bool has() const;
 
     Entity copy(bool isActive = true) const;
+    Entity copyTree(bool isActive = true) const;
 
     void activate() const;
     void deactivate() const;
@@ -91,13 +129,91 @@ public:
     Entity createChild(bool isActive = true) const;
     void orphan() const;
     void forChild(EntityCallback callback, bool isRecursive = false);
-    Entity parent() const;                                           // parent getter
-    const std::unordered_set<Entity, EntityHash>& children() const;  // children getter
+    Entity parent() const;        // parent getter
+    ChildRange children() const;  // children getter
+    u32 depth() const;            // number of ancestors, not counting the world root
 
 private:
     EntityID mId = 0;
 };
 
+// Per-entity hierarchy links. Children form an intrusive doubly-linked sibling list, so reparenting never allocates.
+// Top-level entities are marked with TOP_LEVEL but aren't linked into the world root's list, so creating/killing them
+// never touches shared state. A zeroed node is detached
+struct HierarchyNode {
+    static constexpr EntityID DETACHED = 0;  // parent of dead entities and entities which are being moved
+    static constexpr EntityID TOP_LEVEL = ~EntityID(0);
+
+    EntityID parent = DETACHED;
+    EntityID firstChild = 0;
+    EntityID prevSibling = 0;
+    EntityID nextSibling = 0;
+    u32 childCount = 0;
+    u32 depth = 0;
+};
+
+// Iterable view over an entity's direct children. Moving the current child elsewhere while iterating is fine.
+// The world root's children are found by scanning every ID, so iterating/counting them is O(capacity)
+class ChildRange {
+public:
+    class Iterator {
+    public:
+        // `scanEnd` is 0 when walking a sibling list, or one past the last ID when scanning for top-level entities
+        Iterator(const HierarchyNode* nodes, EntityID current, EntityID scanEnd) : mNodes(nodes), mCurrent(current), mScanEnd(scanEnd) {
+            if (mScanEnd != 0) {
+                mCurrent = nextTopLevel(mCurrent);
+            }
+            mNext = mScanEnd == 0 && mCurrent != 0 ? nodes[mCurrent].nextSibling : 0;
+        }
+
+        Entity operator*() const { return Entity(mCurrent); }
+        bool operator==(const Iterator& other) const { return mCurrent == other.mCurrent; }
+        Iterator& operator++() {
+            if (mScanEnd != 0) {
+                mCurrent = nextTopLevel(mCurrent + 1);
+                return *this;
+            }
+            mCurrent = mNext;
+            mNext = mCurrent != 0 ? mNodes[mCurrent].nextSibling : 0;
+            return *this;
+        }
+
+    private:
+        EntityID nextTopLevel(EntityID id) const {
+            while (id < mScanEnd && mNodes[id].parent != HierarchyNode::TOP_LEVEL) {
+                id++;
+            }
+            return id < mScanEnd ? id : 0;
+        }
+
+        const HierarchyNode* mNodes;
+        EntityID mCurrent;
+        EntityID mNext;
+        EntityID mScanEnd;
+    };
+
+    ChildRange(const HierarchyNode* nodes, EntityID parent, EntityID capacity) : mNodes(nodes), mParent(parent), mCapacity(capacity) {}
+
+    Iterator begin() const { return mParent == 0 ? Iterator(mNodes, 1, mCapacity) : Iterator(mNodes, mNodes[mParent].firstChild, 0); }
+    Iterator end() const { return Iterator(mNodes, 0, 0); }
+    u32 size() const {
+        if (mParent != 0) {
+            return mNodes[mParent].childCount;
+        }
+        u32 count = 0;
+        for (auto it = begin(); it != end(); ++it) {
+            count++;
+        }
+        return count;
+    }
+    bool empty() const { return begin() == end(); }
+
+private:
+    const HierarchyNode* mNodes;
+    EntityID mParent;
+    EntityID mCapacity;
+};
+
 // utility class. Uses RAII to defer an entity's activation until it goes out of scope
 class DeferActivate {
 public:
@@ -129,122 +245,877 @@ public:
     virtual ~IComponentArray() = default;
     virtual void entityDestroyed(Entity entity) = 0;
     virtual void copyComponent(Entity prefab, Entity dest) = 0;
+    virtual void copyComponents(const Entity* prefabs, const Entity* dests, u32 count) = 0;
+
+    // moves the components of src[i] to dst[i] in `dstManager`'s array of the same type, removing them from this array
+    virtual void moveComponents(const Entity* src, const Entity* dst, u32 count, ComponentManager& dstManager) = 0;
+
+    virtual void clear() = 0;  // removes every component
+
+    // moves the entities' components into compressed storage, and back. Storage which can't compress leaves them alone
+    virtual void hibernate(const Entity* entities, u32 count) {}
+    virtual void wake(const Entity* entities, u32 count) {}
+
+    virtual void flush() {}  // writes file-backed storage to disk
+};
+
+// Storage policies. Pick one for a component type with
+// `template <> struct StoragePolicy<Boss> { using type = HashStorage; };`
+struct DenseStorage {};   // sparse set. Fastest access, best for components most entities have
+struct HashStorage {};    // open addressing hash map. Memory scales with the number of components, for rare ones
+struct BitsetStorage {};  // one bit per entity, for tag components without any data
+struct StableStorage {};  // paged. Components never move, so pointers to them survive other entities' removal
+
+// dense, but the tables live in memory-mapped files in `directory`, so they can be larger than RAM. Lambda systems and
+// forEach stream through the table; ISystems which look components up per entity read it in random order instead
+struct MappedStorage {
+    static inline std::string directory = ".";
+    // set when a table's files couldn't be created or mapped (e.g. a missing directory). That table stays in memory
+    static inline std::string error;
+};
+
+// unique file name stem in MappedStorage::directory for a table of `typeName`
+std::string mappedStoragePath(std::string_view typeName);
+
+template <typename T>
+struct StoragePolicy {
+    using type = DenseStorage;
+};
+
+// Splits a component into a hot part (T itself) and a cold part, with
+// `template <> struct ColdPart<Unit> { using type = UnitCold; };`
+// Cold parts live in a separate table with the same dense index, so iterating T doesn't pull them into cache. Only
+// supported by DenseStorage
+template <typename T>
+struct ColdPart {
+    using type = void;
+};
+
+template <typename T>
+concept HasColdPart = !std::is_void_v<typename ColdPart<T>::type>;
+
+template <typename T, typename Policy = typename StoragePolicy<T>::type>
+class ComponentArray;
+
+// Table of cold parts parallel to a dense component table. Each row is constructed the first time it's accessed, so
+// untouched rows never cost memory
+template <typename C>
+class ColdTable {
+public:
+    explicit ColdTable(u32 capacity) : mRows(capacity * sizeof(C)), mLoaded((capacity + 63) / 64 * sizeof(u64)) {}
+
+    bool isLoaded(u32 ix) const { return (loaded()[ix / 64] >> (ix % 64)) & 1; }
+
+    C& get(u32 ix) {
+        if (!isLoaded(ix)) {
+            new (row(ix)) C();
+            loaded()[ix / 64] |= u64(1) << (ix % 64);
+        }
+        return *row(ix);
+    }
+
+    // replaces row `dst` with row `src`, leaving `src` unloaded
+    void move(u32 dst, u32 src) {
+        destroy(dst);
+        if (isLoaded(src)) {
+            new (row(dst)) C(std::move(*row(src)));
+            loaded()[dst / 64] |= u64(1) << (dst % 64);
+            destroy(src);
+        }
+    }
+
+    void copy(u32 dst, u32 src) {
+        if (isLoaded(src)) {
+            get(dst) = *row(src);
+        } else {
+            destroy(dst);
+        }
+    }
+
+    void destroy(u32 ix) {
+        if (isLoaded(ix)) {
+            row(ix)->~C();
+            loaded()[ix / 64] &= ~(u64(1) << (ix % 64));
+        }
+    }
+
+    void clear(u32 size) {
+        for (u32 ix = 0; ix < size; ix++) {
+            destroy(ix);
+        }
+        mRows.release(size * sizeof(C));
+        mLoaded.release((size + 63) / 64 * sizeof(u64));
+    }
+
+private:
+    C* row(u32 ix) const { return static_cast<C*>(mRows.data()) + ix; }
+    u64* loaded() const { return static_cast<u64*>(mLoaded.data()); }
+
+    ZeroedBuffer mRows;
+    ZeroedBuffer mLoaded;
+};
+
+// components without a cold part
+template <>
+class ColdTable<void> {
+public:
+    explicit ColdTable(u32 capacity) {}
+    void move(u32 dst, u32 src) {}
+    void copy(u32 dst, u32 src) {}
+    void destroy(u32 ix) {}
+    void clear(u32 size) {}
 };
 
-// maintains dense component data
+// moves components between worlds, shared by every storage policy
+template <typename T, typename Policy>
+void moveComponentsTo(ComponentArray<T, Policy>& srcArray, const Entity* src, const Entity* dst, u32 count, ComponentManager& dstManager);
+
+// Maintains dense component data. All storage starts out as untouched zero pages, so registering a component costs
+// nothing until entities use it. The sparse array stores index + 1, so 0 means "no component"
 template <typename T>
-class ComponentArray : public IComponentArray {
+class ComponentArray<T, DenseStorage> : public IComponentArray {
 public:
-    ComponentArray() {
-        mEntityToIndex.fill(-1);
-        mIndexToEntity.fill(0);
+    explicit ComponentArray(u32 capacity)
+        : mComponentTable(capacity * sizeof(T)), mEntityToIndex(capacity * sizeof(u32)), mIndexToEntity(capacity * sizeof(EntityID)),
+          mColdTable(capacity) {}
+
+    // keeps the tables in files starting with `pathStem` instead of anonymous memory
+    ComponentArray(u32 capacity, const std::string& pathStem)
+        : mComponentTable(capacity * sizeof(T), pathStem + ".table"), mEntityToIndex(capacity * sizeof(u32), pathStem + ".sparse"),
+          mIndexToEntity(capacity * sizeof(EntityID), pathStem + ".dense"), mColdTable(capacity) {
+        for (const ZeroedBuffer* buffer : {&mComponentTable, &mEntityToIndex, &mIndexToEntity}) {
+            if (!buffer->getError().empty()) {
+                MappedStorage::error = buffer->getError();
+            }
+        }
     }
-    void addData(const Entity entity, T component) {
+    ~ComponentArray() {
+        destroyAll();
+        delete mDormant;
+    }
+
+    void addData(const Entity entity, T component) { insertSlot(entity) = component; }
+
+    // returns the entity's slot in the table, claiming a new one at the end if it doesn't have one yet
+    T& insertSlot(const Entity entity) {
         if (hasData(entity)) {
-            const u32 ix = mEntityToIndex[entity.id()];
-            mComponentTable[ix] = component;
-            return;
+            return table()[indexOf(entity)];
+        }
+        if (mDormant) {
+            mDormant->erase(entity.id());  // a new value replaces the one stored when the entity went dormant
         }
         const u32 ix = mSize++;
-        mEntityToIndex[entity.id()] = ix;
-        mIndexToEntity[ix] = entity.id();
-        mComponentTable[ix] = component;
+        mHighWater = mSize > mHighWater ? mSize : mHighWater;
+        sparse()[entity.id()] = ix + 1;
+        dense()[ix] = entity.id();
+        if constexpr (!std::is_trivially_default_constructible_v<T>) {
+            new (&table()[ix]) T();
+        }
+        return table()[ix];
     }
 
     void setData(const Entity entity, T component) {
-        assert(mEntityToIndex[entity.id()] != -1 && "cannot set component value without adding it to the entity first");
-        mComponentTable[mEntityToIndex[entity.id()]] = component;
+        assert(hasData(entity) && "cannot set component value without adding it to the entity first");
+        table()[indexOf(entity)] = component;
     }
 
     void removeData(const Entity entity) {
+        if (mDormant) {
+            mDormant->erase(entity.id());  // otherwise waking the entity would bring the component back
+        }
         if (!hasData(entity)) {
             return;
         }
 
         // maintain density of entities
-        const u32 removeIx = mEntityToIndex[entity.id()];
+        const u32 removeIx = indexOf(entity);
         const u32 lastIx = --mSize;
         if (removeIx != lastIx) {
-            mComponentTable[removeIx] = mComponentTable[lastIx];
+            copyRange(removeIx, lastIx, 1);
+            mColdTable.move(removeIx, lastIx);
 
-            Entity lastEntity = mIndexToEntity[lastIx];
-            mEntityToIndex[lastEntity.id()] = removeIx;
-            mIndexToEntity[removeIx] = lastEntity.id();
+            const EntityID lastEntity = dense()[lastIx];
+            sparse()[lastEntity] = removeIx + 1;
+            dense()[removeIx] = lastEntity;
+        }
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            table()[lastIx].~T();
         }
+        mColdTable.destroy(lastIx);
 
-        mEntityToIndex[entity.id()] = -1;
-        mIndexToEntity[lastIx] = 0;
+        sparse()[entity.id()] = 0;
+        dense()[lastIx] = 0;
     }
 
-    bool hasData(const Entity entity) const { return mEntityToIndex[entity.id()] != -1; }
+    u32 size() const { return mSize; }  // components stored
+
+    bool hasData(const Entity entity) const { return sparse()[entity.id()] != 0; }
 
     std::optional<T> tryGetData(const Entity entity) {
         if (!hasData(entity)) {
             return std::nullopt;
         }
-        const u32 ix = mEntityToIndex.at(entity.id());
-        return mComponentTable.at(ix);
+        return table()[indexOf(entity)];
     }
 
     T& getData(const Entity entity) {
         assert(hasData(entity) && "getData on entity without component");
-        const u32 ix = mEntityToIndex.at(entity.id());
-        return mComponentTable.at(ix);
+        return table()[indexOf(entity)];
+    }
+
+    auto& getColdData(const Entity entity)
+        requires HasColdPart<T>
+    {
+        assert(hasData(entity) && "getColdData on entity without component");
+        return mColdTable.get(indexOf(entity));
+    }
+
+    bool isColdDataLoaded(const Entity entity) const
+        requires HasColdPart<T>
+    {
+        return mColdTable.isLoaded(indexOf(entity));
+    }
+
+    void entityDestroyed(const Entity entity) override { removeData(entity); }
+
+    // only plain data is compressed. Cold parts would need a second store, so those components stay resident
+    void hibernate(const Entity* entities, u32 count) override {
+        if constexpr (std::is_trivially_copyable_v<T> && !HasColdPart<T>) {
+            for (u32 i = 0; i < count; i++) {
+                if (!hasData(entities[i])) {
+                    continue;
+                }
+                if (!mDormant) {
+                    mDormant = new DormantStore(mEntityToIndex.size() / sizeof(u32), sizeof(T));
+                }
+                // removed first, since removing drops any dormant row the entity already has
+                const T row = getData(entities[i]);
+                removeData(entities[i]);
+                mDormant->store(entities[i].id(), &row);
+            }
+            // the slots past the new end are dead, so hand their pages back. Sparse entries are spread out by ID and
+            // rarely empty a whole page, so those stay
+            mComponentTable.release(mSize * sizeof(T), (mHighWater - mSize) * sizeof(T));
+            mIndexToEntity.release(mSize * sizeof(EntityID), (mHighWater - mSize) * sizeof(EntityID));
+            mHighWater = mSize;
+        }
+    }
+
+    void wake(const Entity* entities, u32 count) override {
+        if (!mDormant) {
+            return;
+        }
+        if constexpr (std::is_trivially_copyable_v<T> && !HasColdPart<T>) {
+            for (u32 i = 0; i < count; i++) {
+                if (mDormant->contains(entities[i].id())) {
+                    // loaded aside first, since claiming a slot drops the entity's dormant row
+                    T row;
+                    mDormant->load(entities[i].id(), &row);
+                    insertSlot(entities[i]) = row;
+                }
+            }
+        }
+    }
+
+    void copyComponent(const Entity prefab, Entity dest) override { copyComponents(&prefab, &dest, 1); }
+
+    void copyComponents(const Entity* prefabs, const Entity* dests, u32 count) override {
+        // new slots are claimed back to back, so runs of prefabs which are also adjacent in the table copy in one go
+        u32 runSrc = 0;
+        u32 runDst = 0;
+        u32 runLength = 0;
+        for (u32 i = 0; i < count; i++) {
+            if (!hasData(prefabs[i])) {
+                continue;
+            }
+            const u32 srcIx = indexOf(prefabs[i]);
+            const u32 dstIx = hasData(dests[i]) ? indexOf(dests[i]) : mSize;
+            insertSlot(dests[i]);
+            mColdTable.copy(dstIx, srcIx);
+            if (runLength != 0 && srcIx == runSrc + runLength && dstIx == runDst + runLength) {
+                runLength++;
+                continue;
+            }
+            copyRange(runDst, runSrc, runLength);
+            runSrc = srcIx;
+            runDst = dstIx;
+            runLength = 1;
+        }
+        copyRange(runDst, runSrc, runLength);
+    }
+
+    void moveComponents(const Entity* src, const Entity* dst, u32 count, ComponentManager& dstManager) override {
+        moveComponentsTo(*this, src, dst, count, dstManager);
+    }
+
+    // calls `fn(entity, component&)` for every component, in storage order
+    template <typename F>
+    void forEach(F&& fn) {
+        for (u32 i = 0; i < mSize; i++) {
+            fn(Entity(dense()[i]), table()[i]);
+        }
+    }
+
+    // backs the first `count` slots with memory now, so adding that many components doesn't page fault
+    void reserve(u32 count) {
+        mComponentTable.commit(count * sizeof(T));
+        mIndexToEntity.commit(count * sizeof(EntityID));
+        mHighWater = count > mHighWater ? count : mHighWater;
+    }
+
+    void clear() override {
+        destroyAll();
+        if (mDormant) {
+            mDormant->clear();
+        }
+        // slots past the current size were touched too if entities died since the peak
+        mColdTable.clear(mHighWater);
+        mComponentTable.release(mHighWater * sizeof(T));
+        mIndexToEntity.release(mHighWater * sizeof(EntityID));
+        mEntityToIndex.release();  // live entries can be anywhere
+        mSize = 0;
+        mHighWater = 0;
+    }
+
+private:
+    T* table() const { return static_cast<T*>(mComponentTable.data()); }
+    u32* sparse() const { return static_cast<u32*>(mEntityToIndex.data()); }
+    EntityID* dense() const { return static_cast<EntityID*>(mIndexToEntity.data()); }
+    u32 indexOf(const Entity entity) const { return sparse()[entity.id()] - 1; }
+
+    // copies table slots [srcIx, srcIx + count) to [dstIx, dstIx + count). Raw bytes for trivially copyable types
+    void copyRange(u32 dstIx, u32 srcIx, u32 count) {
+        if constexpr (std::is_trivially_copyable_v<T>) {
+            std::memmove(static_cast<void*>(&table()[dstIx]), &table()[srcIx], count * sizeof(T));
+        } else {
+            for (u32 i = 0; i < count; i++) {
+                table()[dstIx + i] = table()[srcIx + i];
+            }
+        }
+    }
+
+    void destroyAll() {
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            for (u32 i = 0; i < mSize; i++) {
+                table()[i].~T();
+            }
+        }
+    }
+
+protected:
+    ZeroedBuffer mComponentTable;
+    ZeroedBuffer mEntityToIndex;
+    ZeroedBuffer mIndexToEntity;
+    ColdTable<typename ColdPart<T>::type> mColdTable;
+    DormantStore* mDormant = nullptr;  // created the first time an entity with this component goes dormant
+    u32 mSize = 0;
+    u32 mHighWater = 0;  // most slots touched since the table was last released, so releasing can stop there
+};
+
+// Dense storage in memory-mapped files. The OS pages table data in and out as it's used, so systems can work on
+// tables larger than RAM without knowing about it
+template <typename T>
+class ComponentArray<T, MappedStorage> : public ComponentArray<T, DenseStorage> {
+public:
+    explicit ComponentArray(u32 capacity) : ComponentArray<T, DenseStorage>(capacity, mappedStoragePath(type_of<T>())) {}
+
+    // streams through the table, so the OS reads ahead and drops pages behind instead of evicting hotter data
+    template <typename F>
+    void forEach(F&& fn) {
+        this->mComponentTable.adviseSequential(true);
+        this->mIndexToEntity.adviseSequential(true);
+        ComponentArray<T, DenseStorage>::forEach(fn);
+        this->mComponentTable.adviseSequential(false);
+        this->mIndexToEntity.adviseSequential(false);
+    }
+
+    void flush() override {
+        this->mComponentTable.flush();
+        this->mEntityToIndex.flush();
+        this->mIndexToEntity.flush();
+    }
+};
+
+// Linear probing hash map from entity to component, using backward shift deletion so there are no tombstones. Entity
+// 0 never has components, so it marks empty slots
+template <typename T>
+class ComponentArray<T, HashStorage> : public IComponentArray {
+    static_assert(!HasColdPart<T>, "Cold parts are only supported by DenseStorage");
+public:
+    explicit ComponentArray(u32 capacity) : mCapacity(capacity) {}
+
+    void addData(const Entity entity, T component) { insertSlot(entity) = component; }
+
+    T& insertSlot(const Entity entity) {
+        if ((mSize + 1) * 4 > mSlots.size() * 3) {
+            rehash(mSlots.empty() ? 16 : mSlots.size() * 2);
+        }
+        Slot& slot = mSlots[probe(entity.id())];
+        if (slot.entity != entity.id()) {
+            assert(mSize < mCapacity && "More components than the world has entities");
+            slot.entity = entity.id();
+            mSize++;
+        }
+        return slot.value;
     }
 
-    void entityDestroyed(const Entity entity) override {
+    void setData(const Entity entity, T component) {
+        assert(hasData(entity) && "cannot set component value without adding it to the entity first");
+        getData(entity) = component;
+    }
+
+    void removeData(const Entity entity) {
         if (!hasData(entity)) {
             return;
         }
-        removeData(entity);
+
+        // shift later entries of the probe sequence back so lookups never stop early
+        u32 hole = probe(entity.id());
+        for (u32 next = (hole + 1) & mask(); mSlots[next].entity != 0; next = (next + 1) & mask()) {
+            const u32 home = homeOf(mSlots[next].entity);
+            if (((next - home) & mask()) >= ((next - hole) & mask())) {
+                mSlots[hole] = std::move(mSlots[next]);
+                hole = next;
+            }
+        }
+        mSlots[hole] = Slot();
+        mSize--;
+    }
+
+    bool hasData(const Entity entity) const { return mSize != 0 && mSlots[probe(entity.id())].entity == entity.id(); }
+
+    u32 size() const { return mSize; }  // components stored
+
+    std::optional<T> tryGetData(const Entity entity) {
+        if (!hasData(entity)) {
+            return std::nullopt;
+        }
+        return getData(entity);
+    }
+
+    T& getData(const Entity entity) {
+        assert(hasData(entity) && "getData on entity without component");
+        return mSlots[probe(entity.id())].value;
     }
 
-    void copyComponent(const Entity prefab, Entity dest) override {
-        auto cmpOpt = tryGetData(prefab);
-        if (cmpOpt) {
-            addData(dest, *cmpOpt);
+    void entityDestroyed(const Entity entity) override { removeData(entity); }
+
+    void copyComponent(const Entity prefab, Entity dest) override { copyComponents(&prefab, &dest, 1); }
+
+    void copyComponents(const Entity* prefabs, const Entity* dests, u32 count) override {
+        for (u32 i = 0; i < count; i++) {
+            if (hasData(prefabs[i])) {
+                T value = getData(prefabs[i]);  // inserting can rehash
+                insertSlot(dests[i]) = std::move(value);
+            }
         }
     }
 
+    void moveComponents(const Entity* src, const Entity* dst, u32 count, ComponentManager& dstManager) override {
+        moveComponentsTo(*this, src, dst, count, dstManager);
+    }
+
+    // calls `fn(entity, component&)` for every component, in slot order
+    template <typename F>
+    void forEach(F&& fn) {
+        for (Slot& slot : mSlots) {
+            if (slot.entity != 0) {
+                fn(Entity(slot.entity), slot.value);
+            }
+        }
+    }
+
+    void reserve(u32 count) {
+        u32 slotCount = 16;
+        while (count * 4 > slotCount * 3) {
+            slotCount *= 2;
+        }
+        if (slotCount > mSlots.size()) {
+            rehash(slotCount);
+        }
+    }
+
+    void clear() override {
+        mSlots = {};
+        mSize = 0;
+    }
+
 private:
-    std::array<T, MAX_ENTITIES> mComponentTable;
-    std::array<long, MAX_ENTITIES> mEntityToIndex;
-    std::array<EntityID, MAX_ENTITIES> mIndexToEntity;
+    struct Slot {
+        EntityID entity = 0;
+        T value = T();
+    };
+
+    u32 mask() const { return mSlots.size() - 1; }
+    u32 homeOf(EntityID id) const { return (id * 0x9E3779B1u) >> mShift; }  // fibonacci hashing, IDs are sequential
+
+    // returns the slot holding `id`, or the empty slot where it would go
+    u32 probe(EntityID id) const {
+        u32 ix = homeOf(id);
+        while (mSlots[ix].entity != id && mSlots[ix].entity != 0) {
+            ix = (ix + 1) & mask();
+        }
+        return ix;
+    }
+
+    void rehash(u32 slotCount) {
+        std::vector<Slot> old = std::move(mSlots);
+        mSlots = std::vector<Slot>(slotCount);
+        mShift = 32 - std::countr_zero(slotCount);
+        for (Slot& slot : old) {
+            if (slot.entity != 0) {
+                mSlots[probe(slot.entity)] = std::move(slot);
+            }
+        }
+    }
+
+    std::vector<Slot> mSlots;  // size is a power of two
+    u32 mShift = 32;
     u32 mSize = 0;
+    u32 mCapacity;
+};
+
+// Components live in fixed-size pages which are never moved or freed until clear(), so their addresses are stable.
+// Removal leaves a hole which goes on a free list, and each page has an occupancy bitmap so iteration skips holes
+template <typename T>
+class ComponentArray<T, StableStorage> : public IComponentArray {
+    static_assert(!HasColdPart<T>, "Cold parts are only supported by DenseStorage");
+public:
+    static constexpr u32 PAGE_SIZE = 64;  // one occupancy word per page
+
+    explicit ComponentArray(u32 capacity) : mEntityToSlot(capacity * sizeof(u32)) {}
+    ~ComponentArray() { clear(); }
+
+    void addData(const Entity entity, T component) { insertSlot(entity) = component; }
+
+    T& insertSlot(const Entity entity) {
+        if (hasData(entity)) {
+            return getData(entity);
+        }
+        u32 slot;
+        if (!mFreeSlots.empty()) {
+            slot = mFreeSlots.back();
+            mFreeSlots.pop_back();
+        } else {
+            slot = mSlotCount++;
+            if (slot / PAGE_SIZE == mPages.size()) {
+                mPages.push_back(new Page);
+            }
+        }
+        Page& page = *mPages[slot / PAGE_SIZE];
+        page.occupied |= u64(1) << (slot % PAGE_SIZE);
+        page.entities[slot % PAGE_SIZE] = entity.id();
+        sparse()[entity.id()] = slot + 1;
+        return *new (page.component(slot % PAGE_SIZE)) T();
+    }
+
+    void setData(const Entity entity, T component) {
+        assert(hasData(entity) && "cannot set component value without adding it to the entity first");
+        getData(entity) = component;
+    }
+
+    void removeData(const Entity entity) {
+        if (!hasData(entity)) {
+            return;
+        }
+        const u32 slot = sparse()[entity.id()] - 1;
+        Page& page = *mPages[slot / PAGE_SIZE];
+        page.component(slot % PAGE_SIZE)->~T();
+        page.occupied &= ~(u64(1) << (slot % PAGE_SIZE));
+        sparse()[entity.id()] = 0;
+        mFreeSlots.push_back(slot);
+    }
+
+    u32 size() const { return mSlotCount - mFreeSlots.size(); }  // components stored
+
+    bool hasData(const Entity entity) const { return sparse()[entity.id()] != 0; }
+
+    std::optional<T> tryGetData(const Entity entity) {
+        if (!hasData(entity)) {
+            return std::nullopt;
+        }
+        return getData(entity);
+    }
+
+    T& getData(const Entity entity) {
+        assert(hasData(entity) && "getData on entity without component");
+        const u32 slot = sparse()[entity.id()] - 1;
+        return *mPages[slot / PAGE_SIZE]->component(slot % PAGE_SIZE);
+    }
+
+    void entityDestroyed(const Entity entity) override { removeData(entity); }
+
+    void copyComponent(const Entity prefab, Entity dest) override { copyComponents(&prefab, &dest, 1); }
+
+    void copyComponents(const Entity* prefabs, const Entity* dests, u32 count) override {
+        for (u32 i = 0; i < count; i++) {
+            if (hasData(prefabs[i])) {
+                insertSlot(dests[i]) = getData(prefabs[i]);
+            }
+        }
+    }
+
+    void moveComponents(const Entity* src, const Entity* dst, u32 count, ComponentManager& dstManager) override {
+        moveComponentsTo(*this, src, dst, count, dstManager);
+    }
+
+    // calls `fn(entity, component&)` for every component, in storage order
+    template <typename F>
+    void forEach(F&& fn) {
+        for (Page* page : mPages) {
+            for (u64 occupied = page->occupied; occupied != 0; occupied &= occupied - 1) {
+                const u32 ix = std::countr_zero(occupied);
+                fn(Entity(page->entities[ix]), *page->component(ix));
+            }
+        }
+    }
+
+    void reserve(u32 count) {
+        while (mPages.size() * PAGE_SIZE < count) {
+            mPages.push_back(new Page);
+        }
+    }
+
+    void clear() override {
+        for (Page* page : mPages) {
+            if constexpr (!std::is_trivially_destructible_v<T>) {
+                for (u64 occupied = page->occupied; occupied != 0; occupied &= occupied - 1) {
+                    page->component(std::countr_zero(occupied))->~T();
+                }
+            }
+            delete page;
+        }
+        mPages.clear();
+        mFreeSlots.clear();
+        mEntityToSlot.release();
+        mSlotCount = 0;
+    }
+
+private:
+    struct Page {
+        T* component(u32 ix) { return reinterpret_cast<T*>(storage) + ix; }
+
+        alignas(T) unsigned char storage[PAGE_SIZE * sizeof(T)];
+        EntityID entities[PAGE_SIZE];
+        u64 occupied = 0;
+    };
+
+    u32* sparse() const { return static_cast<u32*>(mEntityToSlot.data()); }
+
+    std::vector<Page*> mPages;
+    std::vector<u32> mFreeSlots;
+    ZeroedBuffer mEntityToSlot;  // slot + 1, so 0 means "no component"
+    u32 mSlotCount = 0;          // slots handed out at least once
+};
+
+// One bit per entity. Only for empty tag types, so every entity can share the same instance
+template <typename T>
+class ComponentArray<T, BitsetStorage> : public IComponentArray {
+    static_assert(!HasColdPart<T>, "Cold parts are only supported by DenseStorage");
+    static_assert(std::is_empty_v<T>, "BitsetStorage can only store components without data");
+
+public:
+    explicit ComponentArray(u32 capacity) : mBits((capacity + 63) / 64 * sizeof(u64)) {}
+
+    void addData(const Entity entity, T component) { insertSlot(entity); }
+
+    T& insertSlot(const Entity entity) {
+        mCount += !hasData(entity);
+        words()[entity.id() / 64] |= u64(1) << (entity.id() % 64);
+        return mValue;
+    }
+
+    void setData(const Entity entity, T component) {
+        assert(hasData(entity) && "cannot set component value without adding it to the entity first");
+    }
+
+    void removeData(const Entity entity) {
+        mCount -= hasData(entity);
+        words()[entity.id() / 64] &= ~(u64(1) << (entity.id() % 64));
+    }
+
+    bool hasData(const Entity entity) const { return (words()[entity.id() / 64] >> (entity.id() % 64)) & 1; }
+
+    u32 size() const { return mCount; }  // entities with the tag
+
+    std::optional<T> tryGetData(const Entity entity) {
+        if (!hasData(entity)) {
+            return std::nullopt;
+        }
+        return mValue;
+    }
+
+    T& getData(const Entity entity) {
+        assert(hasData(entity) && "getData on entity without component");
+        return mValue;
+    }
+
+    void entityDestroyed(const Entity entity) override { removeData(entity); }
+
+    void copyComponent(const Entity prefab, Entity dest) override { copyComponents(&prefab, &dest, 1); }
+
+    void copyComponents(const Entity* prefabs, const Entity* dests, u32 count) override {
+        for (u32 i = 0; i < count; i++) {
+            if (hasData(prefabs[i])) {
+                insertSlot(dests[i]);
+            }
+        }
+    }
+
+    void moveComponents(const Entity* src, const Entity* dst, u32 count, ComponentManager& dstManager) override {
+        moveComponentsTo(*this, src, dst, count, dstManager);
+    }
+
+    // calls `fn(entity, component&)` for every entity with the tag, in ID order
+    template <typename F>
+    void forEach(F&& fn) {
+        const u32 wordCount = mBits.size() / sizeof(u64);
+        for (u32 i = 0; i < wordCount; i++) {
+            for (u64 bits = words()[i]; bits != 0; bits &= bits - 1) {
+                fn(Entity(i * 64 + std::countr_zero(bits)), mValue);
+            }
+        }
+    }
+
+    void reserve(u32 count) {}
+
+    void clear() override {
+        mBits.release();
+        mCount = 0;
+    }
+
+private:
+    u64* words() const { return static_cast<u64*>(mBits.data()); }
+
+    ZeroedBuffer mBits;
+    T mValue;
+    u32 mCount = 0;
+};
+
+struct PatternHash {
+    size_t operator()(const Pattern& pattern) const { return pattern.hash(); }
+};
+
+// Interns component patterns into small archetype IDs. Most entities share a handful of patterns, so anything derived
+// from a pattern can be cached per archetype. Adding/removing one component is cached as an edge between archetypes
+class ArchetypeTable {
+public:
+    static constexpr ArchetypeID EMPTY = 0;  // the pattern with no components
+
+    ArchetypeTable();
+
+    ArchetypeID intern(const Pattern& pattern);
+    ArchetypeID withComponent(ArchetypeID archetype, ComponentType type, bool isAdded);
+    const Pattern& getPattern(ArchetypeID archetype) const { return mPatterns[archetype]; }
+    u32 size() const { return mPatterns.size(); }
+
+private:
+    std::vector<Pattern> mPatterns;
+    std::unordered_map<Pattern, ArchetypeID, PatternHash> mPatternToArchetype;
+    std::unordered_map<u64, ArchetypeID> mEdges;  // key is (archetype, component type, isAdded)
 };
 
 class EntityManager {
 public:
-    EntityManager();
+    EntityManager(ArchetypeTable& archetypes, u32 capacity);
 
-    Entity createEntity(bool isAlive, Entity parent);
+    Entity createEntity(bool isAlive, Entity parent, u32 partition = 0);
     void destroyEntity(Entity entity);
-    void setPattern(Entity entity, const Pattern& pattern);
-    Pattern getPattern(Entity entity) const;
-    u32 getEntityCount() const { return mEntityCount; }
+
+    // each entity stores its interned archetype rather than a full pattern
+    void setPattern(Entity entity, const Pattern& pattern) { mArchetypes[entity.id()] = mArchetypeTable.intern(pattern); }
+    const Pattern& getPattern(Entity entity) const { return mArchetypeTable.getPattern(mArchetypes[entity.id()]); }
+    void setArchetype(Entity entity, ArchetypeID archetype) { mArchetypes[entity.id()] = archetype; }
+    ArchetypeID getArchetype(Entity entity) const { return mArchetypes[entity.id()]; }
+    u32 getEntityCount() const;
+    u32 getCapacity() const { return mCapacity; }
     bool isActive(Entity entity) const;
 
+    // splits the ID space into `count` contiguous ranges. Can only be called while there are no entities
+    void setPartitionCount(u32 count);
+    u32 getPartitionCount() const { return mPartitionCount; }
+    u32 getPartition(Entity entity) const { return entity.id() / mPartitionSize; }
+
     // returns true if entity was activated, false if it was already active
     bool activate(Entity entity);
     bool deactivate(Entity entity);
 
-    std::unordered_map<Entity, Entity, EntityHash> childToParent;
-    std::unordered_map<Entity, std::unordered_set<Entity, EntityHash>, EntityHash> parentToChildren;
+    // dormant entities have their components compressed. Cleared when the entity is destroyed
+    bool isDormant(Entity entity) const { return (mDormantEntities[entity.id() / 64] >> (entity.id() % 64)) & 1; }
+    void setDormant(Entity entity, bool isDormant) {
+        const u64 bit = u64(1) << (entity.id() % 64);
+        mDormantEntities[entity.id() / 64] = isDormant ? mDormantEntities[entity.id() / 64] | bit : mDormantEntities[entity.id() / 64] & ~bit;
+    }
+
+    // HIERARCHY
+    // O(1) and allocation-free. If the child's depth changes, its subtree's cached depth is updated too
+    void setParent(Entity child, Entity parent);
+    void detach(Entity entity);  // removes `entity` from its parent's children. It has no parent until `setParent`
+    Entity getParent(Entity entity) const {
+        const EntityID parent = mHierarchy[entity.id()].parent;
+        return parent == HierarchyNode::TOP_LEVEL ? Entity() : Entity(parent);
+    }
+    ChildRange getChildren(Entity entity) const { return ChildRange(mHierarchy, entity.id(), mCapacity); }
+
+    // calls `fn(entity)` for every active entity, in ID order
+    template <typename F>
+    void forEachActive(F&& fn) const {
+        for (u32 word = 0; word < (mCapacity + 63) / 64; word++) {
+            for (u64 bits = mActiveEntities[word]; bits != 0; bits &= bits - 1) {
+                fn(Entity(word * 64 + std::countr_zero(bits)));
+            }
+        }
+    }
+    u32 getDepth(Entity entity) const { return mHierarchy[entity.id()].depth; }
 
 private:
-    std::queue<EntityID> mAvailableIDs;
-    std::array<Pattern, MAX_ENTITIES> mPatterns;
-    std::bitset<MAX_ENTITIES> mActiveEntities;
-    std::mutex mCreatorMutex;
-    u32 mEntityCount = 0;
+    // each partition owns its own free list, so threads creating/destroying entities in different partitions don't contend.
+    // Partition sizes are multiples of 64 so they never share a word of mActiveEntities. IDs which were never used are
+    // handed out in order before any recycled ones, so storage is only touched as the world grows
+    struct Partition {
+        std::queue<EntityID> availableIDs;  // recycled
+        EntityID nextID = 0;
+        EntityID endID = 0;
+        std::mutex mutex;
+        u32 entityCount = 0;
+    };
+
+    void link(EntityID child, EntityID parent);  // mHierarchyMutex must be held for these
+    void unlink(EntityID child);
+    void updateSubtreeDepth(EntityID top);
+
+    std::array<Partition, MAX_PARTITIONS> mPartitions;
+    u32 mCapacity;
+    u32 mPartitionCount = 1;
+    u32 mPartitionSize;
+    ArchetypeTable& mArchetypeTable;
+    ZeroedBuffer mArchetypeBuffer;
+    ZeroedBuffer mActiveBuffer;
+    ZeroedBuffer mDormantBuffer;
+    ZeroedBuffer mHierarchyBuffer;
+    ArchetypeID* mArchetypes;   // zero is ArchetypeTable::EMPTY
+    u64* mActiveEntities;       // one bit per entity
+    u64* mDormantEntities;      // one bit per entity
+    HierarchyNode* mHierarchy;  // index 0 is the world root
+    std::mutex mHierarchyMutex;
 };
 
 template <typename T>
 class Exclude;
 
+// Specialize to give a component a compile-time ID below MAX_STATIC_COMPONENTS, which lets systems using it build their
+// patterns at compile time: `template <> struct StaticComponentID<Transform> : std::integral_constant<ComponentType, 0> {};`
+template <typename T>
+struct StaticComponentID {};
+
+template <typename T>
+concept HasStaticComponentID = requires { StaticComponentID<T>::value; };
+
 class ComponentManager {
+    static_assert(MAX_STATIC_COMPONENTS < MAX_COMPONENTS, "MAX_STATIC_COMPONENTS leaves no room for runtime component IDs");
+
 public:
-    ComponentManager();
+    explicit ComponentManager(u32 capacity);
     ~ComponentManager();
 
     template <typename T>
@@ -253,17 +1124,29 @@ public:
         assert(type < MAX_COMPONENTS && "Registered more than MAX_COMPONENTS components");
         assert(getIndex<T>() == -1 && "Component type already registered");
         mComponentToIndex[type] = mComponentArrays.size();
-        mComponentArrays.push_back(new ComponentArray<T>());
+        mComponentArrays.push_back(new ComponentArray<T>(mCapacity));
+        mArrayFactories.push_back([](u32 capacity) -> IComponentArray* { return new ComponentArray<T>(capacity); });
     }
 
     template <typename T>
-    void addComponent(const Entity entity, T component) {
+    ComponentArray<T>* getOrRegisterArray() {
         long index = getIndex<T>();
         if (index == -1) {
             registerComponent<T>();
             index = mComponentArrays.size() - 1;
         }
-        getComponentArray<T>(index)->addData(entity, component);
+        return getComponentArray<T>(index);
+    }
+
+    template <typename T>
+    void addComponent(const Entity entity, T component) {
+        getOrRegisterArray<T>()->addData(entity, component);
+    }
+
+    template <typename T>
+    void reserve(u32 count) {
+        assert(count <= mCapacity && "Cannot reserve more components than the world has entities");
+        getOrRegisterArray<T>()->reserve(count);
     }
 
     template <typename T>
@@ -303,22 +1186,47 @@ public:
         return getComponentArray<T>(getIndex<T>())->getData(entity);
     }
 
+    template <typename T>
+    typename ColdPart<T>::type& getColdComponent(const Entity entity) const {
+        return getComponentArray<T>(getIndex<T>())->getColdData(entity);
+    }
+
     void entityDestroyed(const Entity entity);
+    void entityDestroyed(std::span<const Entity> entities, JobPool& pool);  // removes a batch in parallel, one job per array
+    void clear();  // removes every component, but keeps the arrays registered
+    void setCapacity(u32 capacity);  // replaces every array with an empty one sized for `capacity`
+    void hibernate(const std::vector<Entity>& entities);
+    void wake(const std::vector<Entity>& entities);
+    void flush();
     void copyComponents(const Entity prefab, Entity dest);
+    void copyComponents(const std::vector<Entity>& prefabs, const std::vector<Entity>& dests);
+    void moveComponents(const std::vector<Entity>& src, const std::vector<Entity>& dst, ComponentManager& dstManager);
 
-    // assign unique IDs to each component type
-    static inline ComponentType ComponentID = 0;
+    // Assign unique IDs to each component type. Types with a StaticComponentID use it, the rest are numbered at
+    // runtime counting down from MAX_COMPONENTS - 1, and may not reach the range reserved for static IDs
+    static inline std::atomic<ComponentType> ComponentID = 0;  // atomic since worlds can be populated from other threads
     template <typename T>
-        requires(!is_base_of_template<Exclude, T>::value)
+        requires(!is_base_of_template<Exclude, T>::value && HasStaticComponentID<T>)
+    static constexpr ComponentType getComponentID() {
+        static_assert(StaticComponentID<T>::value < MAX_STATIC_COMPONENTS, "StaticComponentID must be less than MAX_STATIC_COMPONENTS");
+        return StaticComponentID<T>::value;
+    }
+
+    template <typename T>
+        requires(!is_base_of_template<Exclude, T>::value && !HasStaticComponentID<T>)
     static inline ComponentType getComponentID() {
-        static ComponentType id = ComponentID++;
+        static ComponentType id = [] {
+            const ComponentType count = ComponentID++;
+            assert(count < MAX_COMPONENTS - MAX_STATIC_COMPONENTS && "Ran out of runtime component IDs. Raise MAX_COMPONENTS");
+            return ComponentType(MAX_COMPONENTS - 1 - count);
+        }();
         return id;
     }
 
     template <typename T>
         requires(is_base_of_template<Exclude, T>::value)
-    static inline ComponentType getComponentID() {
-        return T::COMPONENT_TYPE;
+    static constexpr ComponentType getComponentID() {
+        return getComponentID<typename T::Type>();
     }
 
 private:
@@ -333,17 +1241,81 @@ private:
         return mComponentToIndex[type];
     }
 
+    static constexpr u32 PARALLEL_DESTROY_THRESHOLD = 64;
+
+    u32 mCapacity;
     std::array<long, MAX_COMPONENTS> mComponentToIndex;
     std::vector<IComponentArray*> mComponentArrays;
+    std::vector<IComponentArray* (*)(u32 capacity)> mArrayFactories;  // parallel to mComponentArrays
 };
 
+template <typename T, typename Policy>
+void moveComponentsTo(ComponentArray<T, Policy>& srcArray, const Entity* src, const Entity* dst, u32 count, ComponentManager& dstManager) {
+    ComponentArray<T>* dstArray = nullptr;  // only registered in the destination if there's something to move
+    for (u32 i = 0; i < count; i++) {
+        if (!srcArray.hasData(src[i])) {
+            continue;
+        }
+        if (!dstArray) {
+            dstArray = dstManager.getOrRegisterArray<T>();
+        }
+        T& slot = dstArray->insertSlot(dst[i]);
+        T& value = srcArray.getData(src[i]);
+        if constexpr (std::is_trivially_copyable_v<T>) {
+            std::memcpy(static_cast<void*>(&slot), &value, sizeof(T));
+        } else {
+            slot = std::move(value);
+        }
+        if constexpr (HasColdPart<T>) {
+            if (srcArray.isColdDataLoaded(src[i])) {
+                dstArray->getColdData(dst[i]) = std::move(srcArray.getColdData(src[i]));
+            }
+        }
+        srcArray.removeData(src[i]);
+    }
+}
+
 // wrapper type which tells a system that the entity should *not* have this component
 template <typename T>
 class Exclude {
 public:
+    using Type = T;
     inline static ComponentType COMPONENT_TYPE = ComponentManager::getComponentID<T>();
 };
 
+template <typename T>
+concept HasConstantComponentID = HasStaticComponentID<T> || (is_base_of_template<Exclude, T>::value && HasStaticComponentID<typename T::Type>);
+
+// builds the include (isExclude = false) or exclude pattern for a list of system components
+template <typename... T>
+constexpr Pattern makeSystemPattern([[maybe_unused]] bool isExclude) {
+    Pattern pattern;
+    ((is_base_of_template<Exclude, T>::value == isExclude ? (void)pattern.set(ComponentManager::getComponentID<T>()) : void()), ...);
+    return pattern;
+}
+
+// A system's patterns, computed once per system type. Constant expressions when all components have static IDs
+template <bool IsConstant, typename... T>
+struct SystemPatterns {
+    static constexpr Pattern include() { return INCLUDE; }
+    static constexpr Pattern exclude() { return EXCLUDE; }
+
+    static constexpr Pattern INCLUDE = makeSystemPattern<T...>(false);
+    static constexpr Pattern EXCLUDE = makeSystemPattern<T...>(true);
+};
+
+template <typename... T>
+struct SystemPatterns<false, T...> {
+    static const Pattern& include() {
+        static const Pattern pattern = makeSystemPattern<T...>(false);
+        return pattern;
+    }
+    static const Pattern& exclude() {
+        static const Pattern pattern = makeSystemPattern<T...>(true);
+        return pattern;
+    }
+};
+
 class SystemBase {
 public:
     friend SystemManager;
@@ -351,6 +1323,31 @@ public:
 
     virtual std::unordered_map<EntityID, Entity>& getEntitiesVirtual() = 0;  // only used by SystemManager
     virtual bool isPatternInSystem(Pattern pattern) = 0;
+
+protected:
+    // systems which iterate something other than their entity set can opt into a membership bitset, kept in sync by
+    // the SystemManager, to check entities without a hash lookup
+    void trackMembers() { mIsTrackingMembers = true; }
+    bool isMember(Entity entity) const { return entity.id() / 64 < mMembers.size() && (mMembers[entity.id() / 64] >> (entity.id() % 64)) & 1; }
+
+    // the world this system was registered in. Not set until registration, so it can't be used in constructors
+    World& getWorld() const { return *mWorld; }
+
+private:
+    void setMember(Entity entity, bool isMember) {
+        if (!mIsTrackingMembers) {
+            return;
+        }
+        if (entity.id() / 64 >= mMembers.size()) {
+            mMembers.resize(entity.id() / 64 + 1);
+        }
+        const u64 bit = u64(1) << (entity.id() % 64);
+        mMembers[entity.id() / 64] = isMember ? mMembers[entity.id() / 64] | bit : mMembers[entity.id() / 64] & ~bit;
+    }
+
+    std::vector<u64> mMembers;
+    bool mIsTrackingMembers = false;
+    World* mWorld = nullptr;
 };
 
 // might combine these two? not sure who would use it
@@ -409,52 +1406,24 @@ class AttrUpdateDuringPause {};
 // currently their methods are called manually
 template <typename... T>
 class ISystem : public SystemBase {
+    using Patterns = SystemPatterns<(HasConstantComponentID<T> && ...), T...>;
+
 public:
-    ISystem() {
-        std::vector<ComponentType> componentTypes;
-        std::vector<ComponentType> antiComponentTypes;
-        InitializeIDs<T...>(componentTypes, antiComponentTypes);
-        for (auto const& componentType : componentTypes) {
-            mPattern.set(componentType);
-        }
-        for (auto const& componentType : antiComponentTypes) {
-            mAntiPattern.set(componentType);
-        }
-    }
 
     std::unordered_map<EntityID, Entity>& getEntitiesVirtual() override { return mEntities; }
-    static std::unordered_map<EntityID, Entity>& getEntitiesMutable() { return mEntities; }
-    static std::unordered_map<EntityID, Entity> getEntitiesCopy() { return mEntities; }
-    static const std::unordered_map<EntityID, Entity>& getEntities() { return mEntities; }
-    static Entity first() { return mEntities.begin()->second; }
-    Pattern getPattern() { return mPattern; }
-    bool isPatternInSystem(Pattern pattern) override { return (pattern & mPattern) == mPattern && (pattern & mAntiPattern) == 0; }
-
-private:
-    // need a First and Second, otherwise there is ambiguity when there's only one
-    // element (InitializeIDs<type> vs InitializeIDs<type, <>>)
-    template <typename First, typename Second, typename... Rest>
-    static void InitializeIDs(std::vector<ComponentType>& componentTypes, std::vector<ComponentType>& antiComponentTypes) {
-        if (is_base_of_template<Exclude, First>::value) {
-            antiComponentTypes.push_back(ComponentManager::getComponentID<First>());
-        } else {
-            componentTypes.push_back(ComponentManager::getComponentID<First>());
-        }
-        InitializeIDs<Second, Rest...>(componentTypes, antiComponentTypes);
-    }
-
-    template <typename Last>
-    static void InitializeIDs(std::vector<ComponentType>& componentTypes, std::vector<ComponentType>& antiComponentTypes) {
-        if (is_base_of_template<Exclude, Last>::value) {
-            antiComponentTypes.push_back(ComponentManager::getComponentID<Last>());
-        } else {
-            componentTypes.push_back(ComponentManager::getComponentID<Last>());
-        }
+    static std::unordered_map<EntityID, Entity>& getEntitiesMutable() { return mEntities; }
+    static std::unordered_map<EntityID, Entity> getEntitiesCopy() { return mEntities; }
+    static const std::unordered_map<EntityID, Entity>& getEntities() { return mEntities; }
+    static Entity first() { return mEntities.begin()->second; }
+    static constexpr Pattern getPattern() { return Patterns::include(); }
+    static constexpr Pattern getAntiPattern() { return Patterns::exclude(); }
+    static constexpr bool matches(const Pattern& pattern) {
+        return pattern.contains(Patterns::include()) && !pattern.intersects(Patterns::exclude());
     }
+    bool isPatternInSystem(Pattern pattern) override { return matches(pattern); }
 
+private:
     inline static std::unordered_map<EntityID, Entity> mEntities = {};
-    Pattern mPattern;
-    Pattern mAntiPattern;
 };
 
 // i fucking love concepts
@@ -475,10 +1444,49 @@ struct RenderSystemPair {
     SystemBase* pSystem;
 };
 
+// Update systems run in phases, in this order. World::update runs the first three and flushes deferred commands
+// (kills) after each one. Render is run separately by World::render so it can overlap with the next frame.
+enum class Phase : u16 {
+    PreUpdate,
+    Update,
+    PostUpdate,
+    Render,
+};
+constexpr u16 PHASE_COUNT = 4;
+
+template <typename... T>
+class StaticSchedule;
+
+class StaticScheduleBase {
+public:
+    virtual ~StaticScheduleBase() = default;
+};
+
 class SystemManager {
+    // direct (non-virtual) call to a system's update
+    struct UpdateCall {
+        void (*update)(void* pSystem);
+        void* pSystem;
+    };
+
     struct UpdateGroupInfo {
         int intervalFrame;
         bool isParallel;
+        UpdateCall scheduleCall = {nullptr, nullptr};  // set if this group is a StaticSchedule rather than a list of systems
+    };
+
+    // calls [begin, end) of a RunList, run when the phase's frame is a multiple of intervalFrame
+    struct RunSegment {
+        u32 begin;
+        u32 end;
+        int intervalFrame;
+        bool isParallel;
+    };
+
+    // everything a phase updates in one pause state, flattened so the per-frame loop is a straight walk
+    struct RunList {
+        std::vector<UpdateCall> calls;
+        std::vector<RunSegment> segments;
     };
 
 public:
@@ -487,6 +1495,8 @@ public:
         UpdateDuringPause = 1 << 1,
     };
 
+    SystemManager(World& world, ArchetypeTable& archetypes) : mWorld(world), mArchetypes(archetypes) {}
+
     template <class T>
     T* getSystem() const {
         const SystemId id = getSystemID<T>();
@@ -504,32 +1514,17 @@ public:
         mSystemIdToIndex.insert({id, mSystems.size()});
 
         T* system = new T;
+        addSystemInstance(system, attributes);
+        return system;
+    }
 
-        // The way these two interfaces are used, it's convenient for these list's indices to match with mSystems
-        mUpdateSystems.push_back(toInterfacePtr<T, IUpdate>(system));
-        mMonitorSystems.push_back(toInterfacePtr<T, IMonitorSystem>(system));
-
-        // Check other interfaces. These lists don't store nullptrs;
-        if (auto iPtr = toInterfacePtr<T, IReactToPause>(system); iPtr) {
-            mPauseSystems.push_back(iPtr);
-        }
-        if (auto iPtr = toInterfacePtr<T, IRender>(system); iPtr) {
-            mRenderSystems.push_back({iPtr, system});
-        }
-        if (auto iPtr = toInterfacePtr<T, IRenderLight>(system); iPtr) {
-            mLightRenderSystems.push_back(iPtr);
-        }
-
-        // check attributes
-        if (toInterfacePtr<T, AttrUniqueEntity>(system)) {
-            attributes |= UniqueEntity;
-        }
-        if (toInterfacePtr<T, AttrUpdateDuringPause>(system)) {
-            attributes |= UpdateDuringPause;
-        }
-        mAttributes.push_back(attributes);
-
-        mSystems.push_back(system);
+    // registers a system built at runtime (see World::system) as its own group in `phase`
+    template <class T>
+    T* addRuntimeSystem(T* system, Phase phase, int interval, u16 attributes) {
+        const int ix = mSystems.size();
+        addSystemInstance(system, attributes);
+        mPhaseGroups[static_cast<u16>(phase)].push_back({UpdateGroupInfo(interval, false), {ix}});
+        rebuildRunLists();
         return system;
     }
 
@@ -542,6 +1537,12 @@ public:
         return *this;
     }
 
+    // groups registered after this call are added to `phase`. Groups go in Phase::Update by default
+    SystemManager& phase(Phase phase) {
+        mRegistrationPhase = phase;
+        return *this;
+    }
+
     // registers systems which must run sequentially
     template <class... T>
     SystemManager& sequential(int interval = 1) {
@@ -553,7 +1554,8 @@ public:
                 groupIndices.push_back(i);
             }
         }
-        mUpdateGroups.push_back({UpdateGroupInfo(interval, false), std::move(groupIndices)});
+        mPhaseGroups[static_cast<u16>(mRegistrationPhase)].push_back({UpdateGroupInfo(interval, false), std::move(groupIndices)});
+        rebuildRunLists();
 
         return *this;
     }
@@ -570,15 +1572,53 @@ public:
             }
         }
         bool isParallel = groupIndices.size() > 1;
-        mUpdateGroups.push_back({UpdateGroupInfo(interval, isParallel), std::move(groupIndices)});
+        mPhaseGroups[static_cast<u16>(mRegistrationPhase)].push_back({UpdateGroupInfo(interval, isParallel), std::move(groupIndices)});
+        rebuildRunLists();
+
+        return *this;
+    }
+
+    // Registers a StaticSchedule as a single group in the current phase. Its systems are updated with direct calls in
+    // the order given, and systems wrapped in Parallel<...> are updated concurrently
+    template <class... T>
+    SystemManager& staticSchedule(int interval = 1) {
+        auto* schedule = new StaticSchedule<T...>(*this);
+        mStaticSchedules.push_back(schedule);
+
+        UpdateCall call = {[](void* pSchedule) { static_cast<StaticSchedule<T...>*>(pSchedule)->update(); }, schedule};
+        mPhaseGroups[static_cast<u16>(mRegistrationPhase)].push_back({UpdateGroupInfo(interval, false, call), {}});
+        rebuildRunLists();
 
         return *this;
     }
 
     void clear();
-    void autoUpdate();
-    void onEntityDestroyed(const Entity entity) const;
-    void onEntityPatternChanged(const Entity entity, const Pattern& newEntityPattern) const;
+    bool isPaused() const { return mIsWorldPaused; }
+
+    // pool used for parallel groups and batched membership changes. Defaults to the shared pool
+    void setJobPool(JobPool* pool) { mJobPool = pool; }
+    JobPool& getJobPool() const { return mJobPool ? *mJobPool : JobPool::getInstance(); }
+
+    // Updates every group in `phase`. Each phase counts its own frames for update intervals, so phases can be run from
+    // different threads
+    void runPhase(Phase phase);
+    // Membership updates. Matching systems are cached per archetype and the add/remove delta per archetype transition,
+    // so these are hash lookups plus a walk over the systems that actually change
+    void onEntityActivated(const Entity entity, ArchetypeID archetype);
+    void onEntityDestroyed(const Entity entity, ArchetypeID archetype);
+    void onEntityArchetypeChanged(const Entity entity, ArchetypeID from, ArchetypeID to);
+
+    // Applies many membership changes at once. Use INACTIVE as `from` for activated entities and as `to` for destroyed
+    // ones. Systems update their entity sets in parallel, then monitor callbacks run on the calling thread in the order
+    // of `changes` (removals before additions, by system index). Components must still be in place for onRemove
+    static constexpr ArchetypeID INACTIVE = ~ArchetypeID(0);
+    struct ArchetypeChange {
+        Entity entity;
+        ArchetypeID from;
+        ArchetypeID to;
+    };
+    void onEntitiesChanged(std::span<const ArchetypeChange> changes);
+
     void onPaused();
     void onUnpaused();
 
@@ -594,21 +1634,337 @@ private:
         return id;
     }
 
+    template <class T>
+    void addSystemInstance(T* system, u16 attributes) {
+        system->mWorld = &mWorld;
+        // The way these two interfaces are used, it's convenient for these list's indices to match with mSystems
+        mUpdateSystems.push_back(toInterfacePtr<T, IUpdate>(system));
+        mMonitorSystems.push_back(toInterfacePtr<T, IMonitorSystem>(system));
+        if constexpr (std::is_base_of_v<IUpdate, T>) {
+            // qualified call, so the compiler can skip the vtable and inline small updates
+            mUpdateCalls.push_back({[](void* pSystem) { static_cast<T*>(pSystem)->T::update(); }, system});
+        } else {
+            mUpdateCalls.push_back({nullptr, nullptr});
+        }
+
+        // Check other interfaces. These lists don't store nullptrs;
+        if (auto iPtr = toInterfacePtr<T, IReactToPause>(system); iPtr) {
+            mPauseSystems.push_back(iPtr);
+        }
+        if (auto iPtr = toInterfacePtr<T, IRender>(system); iPtr) {
+            mRenderSystems.push_back({iPtr, system});
+        }
+        if (auto iPtr = toInterfacePtr<T, IRenderLight>(system); iPtr) {
+            mLightRenderSystems.push_back(iPtr);
+        }
+
+        // check attributes
+        if (toInterfacePtr<T, AttrUniqueEntity>(system)) {
+            attributes |= UniqueEntity;
+        }
+        if (toInterfacePtr<T, AttrUpdateDuringPause>(system)) {
+            attributes |= UpdateDuringPause;
+        }
+        mAttributes.push_back(attributes);
+
+        mSystems.push_back(system);
+
+        // cached memberships don't know about this system, and entities which already match it join it now
+        mArchetypeSystems.clear();
+        mDeltas.clear();
+        addExistingEntities(mSystems.size() - 1);
+    }
+
+    void addExistingEntities(u16 system);  // defined in SystemManager.cpp, where World is complete
+
+    // precomputes each phase's run list for both pause states. Called whenever groups change
+    void rebuildRunLists();
+
+    struct MembershipDelta {
+        std::vector<u16> added;
+        std::vector<u16> removed;
+    };
+
+    const std::vector<u16>& getMatchingSystems(ArchetypeID archetype);
+    const MembershipDelta& getDelta(ArchetypeID from, ArchetypeID to);
+    void addToSystems(const Entity entity, const std::vector<u16>& systems);
+    void removeFromSystems(const Entity entity, const std::vector<u16>& systems);
+
     std::unordered_map<SystemId, int> mSystemIdToIndex;
     std::vector<SystemBase*> mSystems;
     std::vector<IUpdate*> mUpdateSystems;          // may contain null ptrs
+    std::vector<UpdateCall> mUpdateCalls;          // may contain null calls
     std::vector<IMonitorSystem*> mMonitorSystems;  // may contain null ptrs
     std::vector<IReactToPause*> mPauseSystems;
     std::vector<RenderSystemPair> mRenderSystems;
     std::vector<IRenderLight*> mLightRenderSystems;
+    std::vector<StaticScheduleBase*> mStaticSchedules;
     std::vector<u16> mAttributes;
 
-    std::vector<std::pair<UpdateGroupInfo, std::vector<int>>>
-        mUpdateGroups;  // ordered list of lists, where each list is 1+ systems which need to be updated sequentially
-    int mFrame = 0;
-    bool mIsWorldPaused = false;
+    // per phase, ordered list of lists, where each list is 1+ systems which need to be updated sequentially
+    std::array<std::vector<std::pair<UpdateGroupInfo, std::vector<int>>>, PHASE_COUNT> mPhaseGroups;
+    std::array<std::array<RunList, 2>, PHASE_COUNT> mRunLists;  // indexed by [phase][isPaused]
+
+    static constexpr u32 PARALLEL_MEMBERSHIP_THRESHOLD = 64;  // smaller batches aren't worth dispatching
+
+    World& mWorld;
+    ArchetypeTable& mArchetypes;
+    // matching system indices, computed on first use. A deque so callbacks growing it don't invalidate lists in use
+    std::deque<std::optional<std::vector<u16>>> mArchetypeSystems;
+    std::unordered_map<u64, MembershipDelta> mDeltas;                // key is (from archetype, to archetype)
+    std::array<int, PHASE_COUNT> mPhaseFrames = {};
+    Phase mRegistrationPhase = Phase::Update;
+    JobPool* mJobPool = nullptr;
+    std::atomic<bool> mIsWorldPaused = false;  // read by the Render phase, which may run on another thread
+};
+
+// marks systems in a StaticSchedule which can be updated in parallel
+template <typename... T>
+struct Parallel {};
+
+// one compile-time step of a StaticSchedule
+template <typename T>
+class ScheduleStep {
+public:
+    explicit ScheduleStep(SystemManager& systemManager) : mSystem(systemManager.registerSystem<T>()) {}
+
+    void update(bool isPaused) const {
+        if constexpr (!std::is_base_of_v<AttrUpdateDuringPause, T>) {
+            if (isPaused) {
+                return;
+            }
+        }
+        mSystem->T::update();
+    }
+
+private:
+    T* mSystem;
+};
+
+template <typename... T>
+class ScheduleStep<Parallel<T...>> {
+public:
+    explicit ScheduleStep(SystemManager& systemManager) : mSystemManager(systemManager), mSteps{ScheduleStep<T>(systemManager)...} {}
+
+    void update(bool isPaused) const {
+        auto job = [this, isPaused](u32 ix) { updateAt(ix, isPaused, std::index_sequence_for<T...>()); };
+        mSystemManager.getJobPool().parallelFor(sizeof...(T), job);
+    }
+
+private:
+    template <size_t... I>
+    void updateAt(u32 ix, bool isPaused, std::index_sequence<I...>) const {
+        ((ix == I ? std::get<I>(mSteps).update(isPaused) : void()), ...);
+    }
+
+    const SystemManager& mSystemManager;
+    std::tuple<ScheduleStep<T>...> mSteps;
+};
+
+// Statically typed list of systems, e.g. StaticSchedule<SysA, SysB, Parallel<SysC, SysD>>. Knows every system's
+// concrete type, so updates are direct calls and pause attributes are resolved at compile time.
+// Register with SystemManager::staticSchedule
+template <typename... T>
+class StaticSchedule : public StaticScheduleBase {
+public:
+    explicit StaticSchedule(SystemManager& systemManager) : mSystemManager(systemManager), mSteps{ScheduleStep<T>(systemManager)...} {}
+
+    void update() const {
+        const bool isPaused = mSystemManager.isPaused();
+        std::apply([isPaused](const auto&... step) { (step.update(isPaused), ...); }, mSteps);
+    }
+
+private:
+    const SystemManager& mSystemManager;
+    std::tuple<ScheduleStep<T>...> mSteps;
+};
+
+// a system whose pattern and update are chosen at runtime. Unlike ISystem, its entities aren't static
+class QuerySystem : public SystemBase {
+public:
+    QuerySystem(std::string name, const Pattern& pattern, const Pattern& antiPattern)
+        : mName(std::move(name)), mPattern(pattern), mAntiPattern(antiPattern) {}
+
+    std::unordered_map<EntityID, Entity>& getEntitiesVirtual() override { return mEntities; }
+    const std::unordered_map<EntityID, Entity>& getEntities() const { return mEntities; }
+    bool isPatternInSystem(Pattern pattern) override { return pattern.contains(mPattern) && !pattern.intersects(mAntiPattern); }
+    const std::string& getName() const { return mName; }
+
+protected:
+    std::unordered_map<EntityID, Entity> mEntities;
+
+private:
+    std::string mName;
+    Pattern mPattern;
+    Pattern mAntiPattern;
+};
+
+template <typename... T>
+struct TypeList {};
+
+// filters Exclude<...> out of a system's component list
+template <typename Out, typename... T>
+struct IncludedComponents {
+    using type = Out;
+};
+
+template <typename... Out, typename First, typename... Rest>
+struct IncludedComponents<TypeList<Out...>, First, Rest...>
+    : IncludedComponents<std::conditional_t<is_base_of_template<Exclude, First>::value, TypeList<Out...>, TypeList<Out..., First>>, Rest...> {};
+
+template <typename F, typename Included>
+class LambdaSystem;
+
+// Calls `fn(entity, components&...)` for every entity. The smallest included table is walked in storage order, skipping
+// components of entities outside the system with a bit test instead of a hash lookup. When the system has far fewer
+// members than that table, the members are visited directly instead. The arrays are looked up once per update
+template <typename F, typename... C>
+class LambdaSystem<F, TypeList<C...>> final : public QuerySystem, public IUpdate {
+public:
+    LambdaSystem(std::string name, const Pattern& pattern, const Pattern& antiPattern, F fn)
+        : QuerySystem(std::move(name), pattern, antiPattern), mFn(std::move(fn)) {
+        trackMembers();
+    }
+
+    void update() override;  // defined after World
+
+private:
+    static constexpr size_t MEMBER_LOOKUP_RATIO = 8;  // walking a table costs about this much less per entry than a lookup
+
+    F mFn;
+};
+
+// Builds a LambdaSystem: `world.system<A, B, Exclude<C>>("name").each([](Entity e, A& a, B& b) { ... });`
+template <typename... T>
+class SystemBuilder {
+public:
+    SystemBuilder(SystemManager& systemManager, std::string name) : mSystemManager(systemManager), mName(std::move(name)) {}
+
+    SystemBuilder& phase(Phase phase) {
+        mPhase = phase;
+        return *this;
+    }
+
+    SystemBuilder& interval(int interval) {
+        mInterval = interval;
+        return *this;
+    }
+
+    SystemBuilder& updateDuringPause() {
+        mAttributes |= SystemManager::UpdateDuringPause;
+        return *this;
+    }
+
+    // registers the system as its own group. The returned system is owned by the SystemManager
+    template <typename F>
+    QuerySystem* each(F fn) {
+        using System = LambdaSystem<F, typename IncludedComponents<TypeList<>, T...>::type>;
+        auto* system = new System(std::move(mName), makeSystemPattern<T...>(false), makeSystemPattern<T...>(true), std::move(fn));
+        return mSystemManager.addRuntimeSystem(system, mPhase, mInterval, mAttributes);
+    }
+
+private:
+    SystemManager& mSystemManager;
+    std::string mName;
+    Phase mPhase = Phase::Update;
+    int mInterval = 1;
+    u16 mAttributes = 0;
+};
+
+// Structural changes recorded now and applied later by the world's thread. Each partition has its own buffer, so jobs
+// working on different partitions record changes without contending. Buffers are applied in partition order at every
+// sync point, and each buffer in the order it was recorded
+class CommandBuffer {
+public:
+    CommandBuffer() = default;
+    ~CommandBuffer();
+    CommandBuffer(const CommandBuffer&) = delete;
+    void operator=(const CommandBuffer&) = delete;
+
+    template <typename T>
+    void add(Entity entity, T component);
+    template <typename T>
+    void remove(Entity entity);
+    void activate(Entity entity);
+    void deactivate(Entity entity);
+    void kill(Entity entity);
+
+    bool empty() const { return mCommands.empty(); }
+
+private:
+    friend World;
+
+    using ApplyFn = void (*)(World& world, Entity entity, void* payload);
+    using DestroyFn = void (*)(void* payload);
+
+    struct Command {
+        ApplyFn apply;
+        DestroyFn destroy;  // null for commands without a payload
+        Entity entity;
+        void* payload;
+    };
+
+    // payloads live in blocks which are reused once the buffer is applied, so recording doesn't allocate in steady state
+    struct Block {
+        std::unique_ptr<std::max_align_t[]> data;
+        size_t size;
+    };
+    static constexpr size_t BLOCK_SIZE = 4096;
+
+    void push(Entity entity, ApplyFn apply, DestroyFn destroy, void* payload) { mCommands.push_back({apply, destroy, entity, payload}); }
+    void* allocatePayload(size_t bytes, size_t alignment);
+    void apply(World& world);  // runs every command in order and empties the buffer
+    void reset();
+
+    std::vector<Command> mCommands;
+    std::vector<Block> mBlocks;
+    size_t mBlockIx = 0;
+    size_t mOffset = 0;  // into mBlocks[mBlockIx]
+};
+
+// Messages between partitions. Any thread can send to a partition, and the job owning that partition receives them, so
+// partition jobs never have to touch each other's entities. Messages from one sender arrive in the order they were sent
+template <typename T>
+class PartitionMailbox {
+public:
+    explicit PartitionMailbox(u32 partitionCount = MAX_PARTITIONS) : mPartitionCount(partitionCount), mInboxes(new Inbox[partitionCount]) {}
+
+    void send(u32 partition, T message) {
+        assert(partition < mPartitionCount && "Partition index out of range");
+        Inbox& inbox = mInboxes[partition];
+        std::unique_lock<std::mutex> lock{inbox.mutex};
+        inbox.messages.push_back(std::move(message));
+    }
+
+    // calls `fn(message)` for everything sent to `partition` so far. Only one thread may receive for a partition
+    template <typename F>
+    void receive(u32 partition, F&& fn) {
+        assert(partition < mPartitionCount && "Partition index out of range");
+        Inbox& inbox = mInboxes[partition];
+        {
+            std::unique_lock<std::mutex> lock{inbox.mutex};
+            std::swap(inbox.messages, inbox.receiving);
+        }
+        for (T& message : inbox.receiving) {
+            fn(message);
+        }
+        inbox.receiving.clear();
+    }
+
+private:
+    struct alignas(64) Inbox {
+        std::mutex mutex;
+        std::vector<T> messages;
+        std::vector<T> receiving;  // only touched by the receiver, keeps its capacity between receives
+    };
+
+    u32 mPartitionCount;
+    std::unique_ptr<Inbox[]> mInboxes;
 };
 
+// The instance returned by `getInstance` is the one `Entity` methods operate on. Additional worlds can be created for
+// staging (e.g. loading a level on a background thread) and moved into the main world with `migrate`. Systems store
+// their entities statically, so a system type should only be registered in one world.
 class World {
 public:
     inline static World& getInstance() {
@@ -616,40 +1972,111 @@ public:
         return instance;
     }
 
+    // `capacity` is the maximum number of entities. Storage for all of them is reserved, but memory is only committed
+    // as entities and components are actually used, so a large capacity is cheap
+    explicit World(u32 capacity = MAX_ENTITIES);
+    ~World();
+
+    void setCapacity(u32 capacity);  // only valid while the world has no entities
+    u32 getCapacity() const { return mEntityManager->getCapacity(); }
+
     // ENTITY
     Entity entity(bool isActive = true) const;
+    Entity entityInPartition(u32 partition, bool isActive = true) const;
     void kill(Entity entity);
     void killEntities();  // called by update. Should only be called manually in specific circumstances like scene loading
 
     Entity copy(Entity entity, bool isActive) const;
+
+    // Copies `root` and all of its descendants, keeping the parent links inside the copy. The new root gets `root`'s
+    // parent. Returns an invalid entity (and creates nothing) if the world doesn't have room for the whole tree
+    Entity copyTree(Entity root, bool isActive) const;
+
+    // Moves `entity` and its children into `dst`, returning its new ID there. The entity becomes a top-level entity in
+    // `dst`, and keeps its active state. Returns an invalid entity (and leaves this world untouched) if `dst` is full.
+    // No create/death callbacks are run.
+    Entity migrate(Entity entity, World& dst);
+
+    // Same as above for several subtrees at once. Parent links between migrated entities are preserved.
+    std::vector<Entity> migrate(const std::vector<Entity>& entities, World& dst);
+
     void activate(Entity entity) const;
     void deactivate(Entity entity) const;
 
+    // DORMANCY
+    // Deactivates the entities and their children, and compresses their plain-data components out of the component
+    // tables. Components of dormant entities can't be read (has<T> still works) and dormant entities can't be copied or
+    // migrated until they're activated again, which decompresses them. Removing a component from a dormant entity drops
+    // its stored value, and adding one replaces it
+    void hibernate(const std::vector<Entity>& entities) const;
+    void activate(const std::vector<Entity>& entities) const;  // wakes all dormant entities in one pass per component type
+
     u32 getEntityCount() const;
     void setEntityDeathCallback(EntityCallback callback);
     void setEntityCreateCallback(EntityCallback callback);
     void setEntityChildCreateCallback(EntityPairCallback callback);
     void setEntityAdoptCallback(EntityPairCallback callback);
 
+    // JOBS
+    // Worlds share JobPool::getInstance() by default. Give a world its own pool to control which cores it runs on when
+    // several worlds share a process. Systems can use `getJobPool().parallelFor` for their own work
+    void setJobPool(JobPool* pool) const { mSystemManager->setJobPool(pool); }  // nullptr goes back to the shared pool
+    JobPool& getJobPool() const { return mSystemManager->getJobPool(); }
+
+    // FRAME MEMORY
+    // Scratch memory for temporaries which are only needed until the end of the frame, e.g. candidate lists or sort
+    // buffers in a system's update. Each thread allocates from its own blocks, and everything is reclaimed at the end of
+    // `update`. Allocations made outside of update (or by the Render phase) last until the end of the next one, so the
+    // world's own temporaries (e.g. from killEntities) only come from here during update
+    FrameAllocator& getFrameAllocator() const { return *mFrameAllocator; }
+    template <typename T>
+    FrameVector<T> frameVector() const {
+        return FrameVector<T>(FrameStlAllocator<T>(*mFrameAllocator));
+    }
+
+    // PARTITION
+    // Partitions split the entity ID space so each thread can own a range of entities. Creating/killing entities in
+    // different partitions doesn't contend. Children are created in their parent's partition.
+    // Component tables and system entity sets are shared by the whole world, so other structural changes (adding or
+    // removing components, activation) aren't thread-safe. Jobs record those in their partition's `commands` instead,
+    // and use a PartitionMailbox to talk to other partitions.
+    void setPartitionCount(u32 count);  // only valid while the world has no entities
+    u32 getPartitionCount() const { return mEntityManager->getPartitionCount(); }
+    u32 partitionOf(Entity entity) const { return mEntityManager->getPartition(entity); }
+    CommandBuffer& commands(u32 partition) {
+        assert(partition < getPartitionCount() && "Partition index out of range");
+        return mCommandBuffers[partition];
+    }
+    void applyCommands();  // called at every sync point. Only needs to be called manually outside of update
+
+    // runs `fn(partition)` for every partition on the job pool and waits for all of them
+    template <typename F>
+    void forEachPartition(F&& fn) const {
+        getJobPool().parallelFor(getPartitionCount(), fn);
+    }
+
     void addChild(Entity parent, Entity child) const;
     Entity createChild(Entity parent, bool isActive) const;
     void orphan(Entity e) const;    // makes mRootEntity the parent of `e`
     void unparent(Entity e) const;  // removes `e` from all parent lists
     void forChild(Entity e, EntityCallback callback, bool isRecursive) const;
     Entity parent(Entity e) const;
-    const std::unordered_set<Entity, EntityHash>& children(Entity e) const;
+    ChildRange children(Entity e) const;
+    u32 depth(Entity e) const;
 
     // COMPONENT
     template <typename T>
     void addComponent(const Entity entity, T component) {
+        assert(!mIsRendering.load(std::memory_order_relaxed) && "Adding a component while rendering. Record it with commands() instead");
         mComponentManager->addComponent(entity, component);
 
-        auto pattern = mEntityManager->getPattern(entity);
-        pattern.set(ComponentManager::getComponentID<T>(), true);
-        mEntityManager->setPattern(entity, pattern);
+        const ArchetypeID from = mEntityManager->getArchetype(entity);
+        const ArchetypeID to = mArchetypes->withComponent(from, ComponentManager::getComponentID<T>(), true);
+        mEntityManager->setArchetype(entity, to);
 
         if (isActive(entity)) {
-            mSystemManager->onEntityPatternChanged(entity, pattern);  // should always go after addComponent so onAdd can run w/out errors
+            // should always go after addComponent so onAdd can run w/out errors
+            mSystemManager->onEntityArchetypeChanged(entity, from, to);
         }
     }
 
@@ -660,11 +2087,13 @@ public:
 
     template <typename T>
     void removeComponent(const Entity entity) {
-        auto pattern = mEntityManager->getPattern(entity);
-        pattern.set(ComponentManager::getComponentID<T>(), false);
-        mEntityManager->setPattern(entity, pattern);
+        assert(!mIsRendering.load(std::memory_order_relaxed) && "Removing a component while rendering. Record it with commands() instead");
+        const ArchetypeID from = mEntityManager->getArchetype(entity);
+        const ArchetypeID to = mArchetypes->withComponent(from, ComponentManager::getComponentID<T>(), false);
+        mEntityManager->setArchetype(entity, to);
         if (isActive(entity)) {
-            mSystemManager->onEntityPatternChanged(entity, pattern);  // should always go before removeComponent so we can run onRemove method
+            // should always go before removeComponent so we can run onRemove method
+            mSystemManager->onEntityArchetypeChanged(entity, from, to);
         }
         mComponentManager->removeComponent<T>(entity);
     }
@@ -684,6 +2113,20 @@ public:
         return mComponentManager->getComponent<T>(entity);
     }
 
+    template <typename T>
+    typename ColdPart<T>::type& getColdComponent(const Entity entity) const {
+        return mComponentManager->getColdComponent<T>(entity);
+    }
+
+    // commits storage for `count` components of type T up front
+    template <typename T>
+    void reserve(u32 count) const {
+        mComponentManager->reserve<T>(count);
+    }
+
+    // writes components with MappedStorage back to their files
+    void flush() const { mComponentManager->flush(); }
+
     // SYSTEM
     template <typename T>
     T* getSystem() const {
@@ -695,17 +2138,37 @@ public:
         return mSystemManager->registerSystem<T>(attributes);
     }
 
+    // starts building a system from a lambda, see SystemBuilder
+    template <typename... T>
+    SystemBuilder<T...> system(std::string name) const {
+        return SystemBuilder<T...>(*mSystemManager, std::move(name));
+    }
+
     const std::vector<RenderSystemPair>& getRenderSystems() const { return mSystemManager->getRenderSystems(); }
     const std::vector<IRenderLight*>& getLightSystems() const { return mSystemManager->getLightSystems(); }
 
     // this doesn't do anything, but I want the caller code to be understandable
     SystemManager& BeginSystemRegistration() const { return *mSystemManager; }
 
+    // runs PreUpdate, Update and PostUpdate, flushing kills after each phase
     void update() {
-        mSystemManager->autoUpdate();
-        killEntities();
+        mIsUpdating = true;
+        runPhase(Phase::PreUpdate);
+        runPhase(Phase::Update);
+        runPhase(Phase::PostUpdate);
+        resetFrameAllocator();
+        mIsUpdating = false;
     }
 
+    // Runs the Render phase. May be called from another thread so render extraction overlaps with the next update's
+    // PreUpdate systems: the sync point at the end of PreUpdate waits for it to finish before flushing. Only the sync
+    // points are protected, so PreUpdate systems must record structural changes with `commands()` (adding or removing
+    // components directly asserts while a render is running), and pause/unpause must not overlap a render
+    void render();
+
+    // Runs one simulation phase followed by its sync point
+    void runPhase(Phase phase);
+
     void pause() const { mSystemManager->onPaused(); }
 
     void unpause() const { mSystemManager->onUnpaused(); }
@@ -714,18 +2177,42 @@ public:
 
 private:
     // no copy
-    World();
-    ~World();
     World(const World&) = delete;
     void operator=(const World&) = delete;
 
+    friend class TransformSystem;  // walks the hierarchy and component tables directly
+    friend class SystemManager;    // adds existing entities to systems registered late
+    template <typename F, typename Included>
+    friend class LambdaSystem;
+
     // is private because it's a bad idea to use this in game logic. An entity's ID could be recycled at any time
     bool isActive(Entity entity) const;
 
+    void collectSubtrees(const std::vector<Entity>& roots, std::vector<Entity>& out) const;  // parents before children
+    void resetFrameAllocator();
+
+    // for the world's own temporaries. Frame memory during update, the heap otherwise, since nothing would reclaim it
+    template <typename T>
+    FrameStlAllocator<T> scratchAllocator() const {
+        return mIsUpdating ? FrameStlAllocator<T>(*mFrameAllocator) : FrameStlAllocator<T>();
+    }
+
+    // entities queued for death, bucketed by partition so `kill` from different partitions doesn't contend
+    struct KillQueue {
+        std::unordered_set<Entity, EntityHash> entities;
+        std::mutex mutex;
+    };
+
+    ArchetypeTable* mArchetypes;  // shared by the entity and system managers, outlives clear()
+    FrameAllocator* mFrameAllocator;
     EntityManager* mEntityManager;
     ComponentManager* mComponentManager;
     SystemManager* mSystemManager;
-    std::unordered_set<Entity, EntityHash> mToKill;
+    std::array<KillQueue, MAX_PARTITIONS> mToKill;
+    std::array<CommandBuffer, MAX_PARTITIONS> mCommandBuffers;
+    std::mutex mRenderMutex;  // held while the Render phase runs
+    std::atomic<bool> mIsRendering = false;
+    bool mIsUpdating = false;  // inside update, so the frame allocator will be reset
     EntityCallback mDeathCallback = nullptr;
     EntityCallback mCreateCallback = nullptr;
     EntityPairCallback mChildCreateCallback = nullptr;
@@ -733,6 +2220,72 @@ private:
     Entity mRootEntity;  // I use the "invalid" entity as the world root. Entities created with `entity()` are children of this entity.
 };
 
+template <typename F, typename... C>
+void LambdaSystem<F, TypeList<C...>>::update() {
+    if (mEntities.empty()) {
+        return;
+    }
+    if constexpr (sizeof...(C) == 0) {
+        for (auto& [id, entity] : mEntities) {
+            mFn(entity);
+        }
+    } else {
+        std::tuple<ComponentArray<C>*...> arrays = {getWorld().mComponentManager->template getOrRegisterArray<C>()...};
+
+        // the smallest table is walked. On a tie a mapped table wins, so its forEach can tell the OS to read ahead
+        constexpr bool IS_MAPPED[] = {std::is_same_v<typename StoragePolicy<C>::type, MappedStorage>...};
+        const u32 sizes[] = {std::get<ComponentArray<C>*>(arrays)->size()...};
+        size_t driverIx = 0;
+        for (size_t i = 1; i < sizeof...(C); i++) {
+            if (sizes[i] < sizes[driverIx] || (sizes[i] == sizes[driverIx] && IS_MAPPED[i] && !IS_MAPPED[driverIx])) {
+                driverIx = i;
+            }
+        }
+
+        // a few members spread through big tables are cheaper to look up one by one
+        if (mEntities.size() * MEMBER_LOOKUP_RATIO < sizes[driverIx]) {
+            for (auto& [id, entity] : mEntities) {
+                mFn(entity, std::get<ComponentArray<C>*>(arrays)->getData(entity)...);
+            }
+            return;
+        }
+
+        auto walk = [&]<typename Driver>(ComponentArray<Driver>* driverArray) {
+            driverArray->forEach([&](Entity entity, Driver& driver) {
+                if (!isMember(entity)) {
+                    return;
+                }
+                auto component = [&]<typename T>(ComponentArray<T>* array) -> T& {
+                    if constexpr (std::is_same_v<T, Driver>) {
+                        return driver;
+                    } else {
+                        return array->getData(entity);
+                    }
+                };
+                mFn(entity, component(std::get<ComponentArray<C>*>(arrays))...);
+            });
+        };
+        [&]<size_t... I>(std::index_sequence<I...>) {
+            ((I == driverIx ? walk(std::get<I>(arrays)) : void()), ...);
+        }(std::index_sequence_for<C...>());
+    }
+}
+
+template <typename T>
+void CommandBuffer::add(Entity entity, T component) {
+    T* payload = new (allocatePayload(sizeof(T), alignof(T))) T(std::move(component));
+    auto apply = [](World& world, Entity e, void* p) {
+        world.addComponent<T>(e, std::move(*static_cast<T*>(p)));
+        static_cast<T*>(p)->~T();
+    };
+    push(entity, apply, [](void* p) { static_cast<T*>(p)->~T(); }, payload);
+}
+
+template <typename T>
+void CommandBuffer::remove(Entity entity) {
+    push(entity, [](World& world, Entity e, void*) { world.removeComponent<T>(e); }, nullptr, nullptr);
+}
+
 template <typename T>
 Entity Entity::add(T component) {
     World::getInstance().addComponent<T>(*this, component);
@@ -767,6 +2320,11 @@ T& Entity::get() const {
     return World::getInstance().getComponent<T>(*this);
 }
 
+template <typename T>
+typename ColdPart<T>::type& Entity::getCold() const {
+    return World::getInstance().getColdComponent<T>(*this);
+}
+
 template <typename T>
 bool Entity::has() const {
     return World::getInstance().hasComponent<T>(*this);
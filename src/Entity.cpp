@@ -8,6 +8,10 @@ Entity Entity::copy(bool isActive) const {
     return World::getInstance().copy(*this, isActive);
 }
 
+Entity Entity::copyTree(bool isActive) const {
+    return World::getInstance().copyTree(*this, isActive);
+}
+
 void Entity::kill() const {
     World::getInstance().kill(*this);
 }
@@ -44,8 +48,12 @@ Entity Entity::parent() const {
     return World::getInstance().parent(*this);
 }
 
-const std::unordered_set<Entity, EntityHash>& Entity::children() const {
+ChildRange Entity::children() const {
     return World::getInstance().children(*this);
 }
 
+u32 Entity::depth() const {
+    return World::getInstance().depth(*this);
+}
+
 }  // namespace whal::ecs
@@ -3,58 +3,203 @@
 
 namespace whal::ecs {
 
-EntityManager::EntityManager() {
-    // entity ID 0 is reserved as a Dummy ID (in case entity creation fails)
-    for (u32 entity = 1; entity < MAX_ENTITIES; entity++) {
-        mAvailableIDs.push(entity);
-    }
-    mActiveEntities.reset();
+EntityManager::EntityManager(ArchetypeTable& archetypes, u32 capacity)
+    : mCapacity(capacity), mPartitionSize(capacity), mArchetypeTable(archetypes), mArchetypeBuffer(capacity * sizeof(ArchetypeID)),
+      mActiveBuffer((capacity + 63) / 64 * sizeof(u64)), mDormantBuffer((capacity + 63) / 64 * sizeof(u64)),
+      mHierarchyBuffer(capacity * sizeof(HierarchyNode)), mArchetypes(static_cast<ArchetypeID*>(mArchetypeBuffer.data())),
+      mActiveEntities(static_cast<u64*>(mActiveBuffer.data())), mDormantEntities(static_cast<u64*>(mDormantBuffer.data())),
+      mHierarchy(static_cast<HierarchyNode*>(mHierarchyBuffer.data())) {
+    static_assert(ArchetypeTable::EMPTY == 0 && HierarchyNode::DETACHED == 0, "zeroed storage must be a valid empty state");
+    setPartitionCount(1);
 }
 
-Entity EntityManager::createEntity(bool isAlive, Entity parent) {
-    std::unique_lock<std::mutex> lock{mCreatorMutex};
-    if (mEntityCount + 1 >= MAX_ENTITIES) {
-        // TODO logging
-        return Entity{0};
+Entity EntityManager::createEntity(bool isAlive, Entity parent, u32 partition) {
+    assert(partition < mPartitionCount && "Partition index out of range");
+    Partition& part = mPartitions[partition];
+    EntityID id;
+    {
+        std::unique_lock<std::mutex> lock{part.mutex};
+        if (part.nextID != part.endID) {
+            id = part.nextID++;
+        } else if (!part.availableIDs.empty()) {
+            id = part.availableIDs.front();
+            part.availableIDs.pop();
+        } else {
+            // TODO logging
+            return Entity{0};
+        }
+        part.entityCount++;
+        if ((parent.id() == 0 || isActive(parent)) && isAlive) {
+            mActiveEntities[id / 64] |= u64(1) << (id % 64);
+        }
     }
-    const EntityID id = mAvailableIDs.front();
-    mAvailableIDs.pop();
-    mEntityCount++;
-    if ((parent.id() == 0 || isActive(parent)) && isAlive) {
-        mActiveEntities.set(static_cast<u32>(id));
+
+    mHierarchy[id] = HierarchyNode();  // no children
+    if (parent.id() == 0) {
+        // top-level entities only touch their own node
+        mHierarchy[id].parent = HierarchyNode::TOP_LEVEL;
+        return Entity{id};
     }
 
-    const Entity self = Entity{id};
-    parentToChildren[self].clear();         // no children
-    parentToChildren[parent].insert(self);  // add self as child of parent
-    childToParent[self] = parent;           // add our parent
-    return self;
+    std::unique_lock<std::mutex> lock{mHierarchyMutex};
+    link(id, parent.id());
+    mHierarchy[id].depth = mHierarchy[parent.id()].depth + 1;
+    return Entity{id};
 }
 
 void EntityManager::destroyEntity(Entity entity) {
-    mActiveEntities.reset(static_cast<u32>(entity.id()));
-    mPatterns[entity.mId].reset();  // invalidate pattern
-    mAvailableIDs.push(entity.id());
-    mEntityCount--;
+    HierarchyNode& node = mHierarchy[entity.id()];
+    const bool isUnlinked = node.parent == HierarchyNode::TOP_LEVEL || node.parent == HierarchyNode::DETACHED;
+    if (isUnlinked && node.firstChild == 0) {
+        // killEntities detaches first, so this is the usual case. No other node refers to this one
+        node = HierarchyNode();
+    } else {
+        // children are usually dying in the same batch, but they must not point at this ID once it's recycled
+        std::unique_lock<std::mutex> lock{mHierarchyMutex};
+        unlink(entity.id());
+        for (EntityID child = mHierarchy[entity.id()].firstChild; child != 0;) {
+            const EntityID next = mHierarchy[child].nextSibling;
+            mHierarchy[child].parent = HierarchyNode::DETACHED;
+            mHierarchy[child].prevSibling = 0;
+            mHierarchy[child].nextSibling = 0;
+            child = next;
+        }
+        node = HierarchyNode();
+    }
+
+    Partition& part = mPartitions[getPartition(entity)];
+    std::unique_lock<std::mutex> lock{part.mutex};
+    mActiveEntities[entity.id() / 64] &= ~(u64(1) << (entity.id() % 64));
+    mDormantEntities[entity.id() / 64] &= ~(u64(1) << (entity.id() % 64));
+    mArchetypes[entity.mId] = ArchetypeTable::EMPTY;  // invalidate pattern
+    part.availableIDs.push(entity.id());
+    part.entityCount--;
+}
+
+u32 EntityManager::getEntityCount() const {
+    u32 count = 0;
+    for (u32 i = 0; i < mPartitionCount; i++) {
+        count += mPartitions[i].entityCount;
+    }
+    return count;
+}
+
+void EntityManager::setPartitionCount(u32 count) {
+    assert(count > 0 && count <= MAX_PARTITIONS && "Partition count out of range");
+    assert(getEntityCount() == 0 && "Cannot repartition a world with living entities");
+
+    // round up to a multiple of 64 so partitions don't share words of mActiveEntities
+    mPartitionSize = ((mCapacity + count - 1) / count + 63) / 64 * 64;
+    assert((count - 1) * mPartitionSize < mCapacity && "Too many partitions for the world's capacity");
+    mPartitionCount = count;
+
+    for (u32 i = 0; i < MAX_PARTITIONS; i++) {
+        Partition& part = mPartitions[i];
+        part.availableIDs = {};
+        part.entityCount = 0;
+
+        // entity ID 0 is reserved as a Dummy ID (in case entity creation fails)
+        part.nextID = i >= count ? 0 : i == 0 ? 1 : i * mPartitionSize;
+        part.endID = i >= count ? 0 : i + 1 == count ? mCapacity : (i + 1) * mPartitionSize;
+    }
+}
+
+void EntityManager::setParent(Entity child, Entity parent) {
+    std::unique_lock<std::mutex> lock{mHierarchyMutex};
+#ifndef NDEBUG
+    for (EntityID ancestor = parent.id(); ancestor != HierarchyNode::TOP_LEVEL && ancestor != HierarchyNode::DETACHED;
+         ancestor = mHierarchy[ancestor].parent) {
+        assert(ancestor != child.id() && "Reparenting would create a cycle");
+    }
+#endif
+    unlink(child.id());
+    link(child.id(), parent.id());
+
+    const u32 depth = parent.id() == 0 ? 0 : mHierarchy[parent.id()].depth + 1;
+    if (mHierarchy[child.id()].depth != depth) {
+        mHierarchy[child.id()].depth = depth;
+        updateSubtreeDepth(child.id());
+    }
+}
+
+void EntityManager::detach(Entity entity) {
+    // top-level and detached entities aren't in any sibling list, so only their own node changes
+    HierarchyNode& node = mHierarchy[entity.id()];
+    if (node.parent == HierarchyNode::TOP_LEVEL || node.parent == HierarchyNode::DETACHED) {
+        node.parent = HierarchyNode::DETACHED;
+        return;
+    }
+    std::unique_lock<std::mutex> lock{mHierarchyMutex};
+    unlink(entity.id());
 }
 
-void EntityManager::setPattern(Entity entity, const Pattern& pattern) {
-    mPatterns[entity.mId] = pattern;
+void EntityManager::link(EntityID child, EntityID parent) {
+    HierarchyNode& childNode = mHierarchy[child];
+    if (parent == 0) {
+        // top-level membership is implicit
+        childNode.parent = HierarchyNode::TOP_LEVEL;
+        return;
+    }
+    childNode.parent = parent;
+    HierarchyNode& parentNode = mHierarchy[parent];
+    childNode.prevSibling = 0;
+    childNode.nextSibling = parentNode.firstChild;
+    if (parentNode.firstChild != 0) {
+        mHierarchy[parentNode.firstChild].prevSibling = child;
+    }
+    parentNode.firstChild = child;
+    parentNode.childCount++;
 }
 
-Pattern EntityManager::getPattern(Entity entity) const {
-    return mPatterns[entity.mId];
+void EntityManager::unlink(EntityID child) {
+    HierarchyNode& childNode = mHierarchy[child];
+    if (childNode.parent == HierarchyNode::TOP_LEVEL) {
+        childNode.parent = HierarchyNode::DETACHED;
+        return;
+    }
+    if (childNode.parent == HierarchyNode::DETACHED) {
+        return;
+    }
+    HierarchyNode& parentNode = mHierarchy[childNode.parent];
+    if (childNode.prevSibling != 0) {
+        mHierarchy[childNode.prevSibling].nextSibling = childNode.nextSibling;
+    } else {
+        parentNode.firstChild = childNode.nextSibling;
+    }
+    if (childNode.nextSibling != 0) {
+        mHierarchy[childNode.nextSibling].prevSibling = childNode.prevSibling;
+    }
+    parentNode.childCount--;
+    childNode.parent = HierarchyNode::DETACHED;
+    childNode.prevSibling = 0;
+    childNode.nextSibling = 0;
+}
+
+// depth-first walk over the sibling links, so no stack is needed
+void EntityManager::updateSubtreeDepth(EntityID top) {
+    EntityID current = mHierarchy[top].firstChild;
+    while (current != 0) {
+        mHierarchy[current].depth = mHierarchy[mHierarchy[current].parent].depth + 1;
+        if (mHierarchy[current].firstChild != 0) {
+            current = mHierarchy[current].firstChild;
+            continue;
+        }
+        while (current != top && mHierarchy[current].nextSibling == 0) {
+            current = mHierarchy[current].parent;
+        }
+        current = current == top ? 0 : mHierarchy[current].nextSibling;
+    }
 }
 
 bool EntityManager::isActive(Entity entity) const {
-    return mActiveEntities.test(static_cast<u32>(entity.id()));
+    return (mActiveEntities[entity.id() / 64] >> (entity.id() % 64)) & 1;
 }
 
 bool EntityManager::activate(Entity entity) {
     if (isActive(entity)) {
         return false;
     }
-    mActiveEntities.set(static_cast<u32>(entity.id()));
+    mActiveEntities[entity.id() / 64] |= u64(1) << (entity.id() % 64);
     return true;
 }
 
@@ -62,7 +207,7 @@ bool EntityManager::deactivate(Entity entity) {
     if (!isActive(entity)) {
         return false;
     }
-    mActiveEntities.reset(static_cast<u32>(entity.id()));
+    mActiveEntities[entity.id() / 64] &= ~(u64(1) << (entity.id() % 64));
     return true;
 }
 
@@ -0,0 +1,115 @@
+#include "FrameAllocator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <new>
+
+namespace whal::ecs {
+
+namespace {
+
+struct CachedArena {
+    u64 allocatorId = 0;
+    void* arena = nullptr;
+};
+
+thread_local CachedArena tlCachedArena;
+std::atomic<u64> nextAllocatorId = 1;
+
+u8* alignUp(u8* ptr, size_t alignment) {
+    return reinterpret_cast<u8*>((reinterpret_cast<uintptr_t>(ptr) + alignment - 1) & ~(uintptr_t(alignment) - 1));
+}
+
+}  // namespace
+
+FrameAllocator::FrameAllocator() : mId(nextAllocatorId++) {}
+
+FrameAllocator::~FrameAllocator() {
+    for (auto& [thread, arena] : mArenas) {
+        for (const Block& block : arena->blocks) {
+            ::operator delete(block.data, std::align_val_t(alignof(std::max_align_t)));
+        }
+    }
+}
+
+void* FrameAllocator::allocate(size_t bytes, size_t alignment) {
+    assert(alignment <= alignof(std::max_align_t) && "Over-aligned types aren't supported");
+    ThreadArena& arena = getArena();
+    if (arena.blockIx < arena.blocks.size()) {
+        const Block& block = arena.blocks[arena.blockIx];
+        u8* ptr = alignUp(block.data + arena.offset, alignment);
+        if (ptr + bytes <= block.data + block.size) {
+            arena.offset = ptr + bytes - block.data;
+            return ptr;
+        }
+    }
+    return allocateFromNewBlock(arena, bytes);
+}
+
+void FrameAllocator::deallocate(void* ptr, size_t bytes) {
+    // containers usually free the buffer they just grew out of, which is only on top if nothing was allocated since
+    ThreadArena& arena = getArena();
+    if (arena.blockIx < arena.blocks.size() && static_cast<u8*>(ptr) + bytes == arena.blocks[arena.blockIx].data + arena.offset) {
+        arena.offset -= bytes;
+    }
+}
+
+void FrameAllocator::reset() {
+    std::unique_lock<std::mutex> lock{mMutex};
+    for (auto& [thread, arena] : mArenas) {
+        if (arena->blocks.size() > 1) {
+            // this frame needed several blocks, so the next one gets a single block big enough for all of them
+            size_t total = 0;
+            for (const Block& block : arena->blocks) {
+                total += block.size;
+                ::operator delete(block.data, std::align_val_t(alignof(std::max_align_t)));
+            }
+            arena->blocks = {{static_cast<u8*>(::operator new(total, std::align_val_t(alignof(std::max_align_t)))), total}};
+        }
+        arena->blockIx = 0;
+        arena->offset = 0;
+    }
+}
+
+size_t FrameAllocator::getCapacity() const {
+    std::unique_lock<std::mutex> lock{mMutex};
+    size_t total = 0;
+    for (auto& [thread, arena] : mArenas) {
+        for (const Block& block : arena->blocks) {
+            total += block.size;
+        }
+    }
+    return total;
+}
+
+FrameAllocator::ThreadArena& FrameAllocator::getArena() {
+    if (tlCachedArena.allocatorId == mId) {
+        return *static_cast<ThreadArena*>(tlCachedArena.arena);
+    }
+    std::unique_lock<std::mutex> lock{mMutex};
+    std::unique_ptr<ThreadArena>& arena = mArenas[std::this_thread::get_id()];
+    if (!arena) {
+        arena = std::make_unique<ThreadArena>();
+    }
+    tlCachedArena = {mId, arena.get()};
+    return *arena;
+}
+
+void* FrameAllocator::allocateFromNewBlock(ThreadArena& arena, size_t bytes) {
+    // move on to the next block this frame if it fits, otherwise add one
+    while (arena.blockIx + 1 < arena.blocks.size()) {
+        arena.blockIx++;
+        if (bytes <= arena.blocks[arena.blockIx].size) {
+            arena.offset = bytes;
+            return arena.blocks[arena.blockIx].data;
+        }
+    }
+    const size_t size = std::max(BLOCK_SIZE, bytes);
+    arena.blocks.push_back({static_cast<u8*>(::operator new(size, std::align_val_t(alignof(std::max_align_t)))), size});
+    arena.blockIx = arena.blocks.size() - 1;
+    arena.offset = bytes;
+    return arena.blocks.back().data;
+}
+
+}  // namespace whal::ecs
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+typedef uint8_t u8;
+typedef uint64_t u64;
+
+namespace whal::ecs {
+
+// Linear allocator for temporaries which only live until the end of the frame. Each thread bumps a pointer through its
+// own blocks, so allocating never locks or calls malloc once the blocks have grown to fit a frame. Nothing is freed
+// individually: `reset` reclaims everything at once and merges each thread's blocks so the next frame fits in one
+class FrameAllocator {
+public:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    FrameAllocator();
+    ~FrameAllocator();
+    FrameAllocator(const FrameAllocator&) = delete;
+    void operator=(const FrameAllocator&) = delete;
+
+    void* allocate(size_t bytes, size_t alignment);
+    void deallocate(void* ptr, size_t bytes);  // only reclaims the calling thread's most recent allocation
+    void reset();                              // no thread may be using memory from this allocator
+
+    size_t getCapacity() const;  // bytes reserved across all threads
+
+private:
+    struct Block {
+        u8* data;
+        size_t size;
+    };
+
+    struct ThreadArena {
+        std::vector<Block> blocks;
+        size_t blockIx = 0;
+        size_t offset = 0;  // into blocks[blockIx]
+    };
+
+    ThreadArena& getArena();
+    static void* allocateFromNewBlock(ThreadArena& arena, size_t bytes);  // blocks are aligned for any type
+
+    u64 mId;  // unique per allocator, so a thread's cached arena is never mistaken for one from a destroyed allocator
+    mutable std::mutex mMutex;
+    std::unordered_map<std::thread::id, std::unique_ptr<ThreadArena>> mArenas;
+};
+
+// STL allocator which draws from a FrameAllocator. Containers using it must not outlive the frame. A default
+// constructed one uses the heap instead, for temporaries made where no frame will reset the allocator
+template <typename T>
+class FrameStlAllocator {
+public:
+    using value_type = T;
+
+    FrameStlAllocator() = default;
+    explicit FrameStlAllocator(FrameAllocator& allocator) : mAllocator(&allocator) {}
+    template <typename U>
+    FrameStlAllocator(const FrameStlAllocator<U>& other) : mAllocator(other.mAllocator) {}
+
+    T* allocate(size_t count) {
+        if (!mAllocator) {
+            return std::allocator<T>().allocate(count);
+        }
+        return static_cast<T*>(mAllocator->allocate(count * sizeof(T), alignof(T)));
+    }
+    void deallocate(T* ptr, size_t count) {
+        if (!mAllocator) {
+            std::allocator<T>().deallocate(ptr, count);
+            return;
+        }
+        mAllocator->deallocate(ptr, count * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const FrameStlAllocator<U>& other) const {
+        return mAllocator == other.mAllocator;
+    }
+
+private:
+    template <typename U>
+    friend class FrameStlAllocator;
+
+    FrameAllocator* mAllocator = nullptr;
+};
+
+template <typename T>
+using FrameVector = std::vector<T, FrameStlAllocator<T>>;
+
+}  // namespace whal::ecs
@@ -0,0 +1,222 @@
+#include "JobPool.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <cassert>
+
+namespace whal::ecs {
+
+namespace {
+
+thread_local const JobPool* tlPool = nullptr;
+thread_local u32 tlWorkerIx = 0;
+
+struct InstanceConfig {
+    JobPool::Config config;
+    bool isUsed = false;
+};
+
+InstanceConfig& getInstanceConfig() {
+    static InstanceConfig instanceConfig;
+    return instanceConfig;
+}
+
+const JobPool::Config& claimInstanceConfig() {
+    getInstanceConfig().isUsed = true;
+    return getInstanceConfig().config;
+}
+
+}  // namespace
+
+JobPool& JobPool::getInstance() {
+    static JobPool instance(claimInstanceConfig());
+    return instance;
+}
+
+void JobPool::configureInstance(const Config& config) {
+    assert(!getInstanceConfig().isUsed && "The shared job pool already exists");
+    getInstanceConfig().config = config;
+}
+
+JobPool::JobPool(const Config& config) : mQueues(new WorkQueue[config.workerCount + 1]) {
+    mWorkers.reserve(config.workerCount);
+    for (u32 i = 0; i < config.workerCount; i++) {
+        mWorkers.emplace_back(&JobPool::workerLoop, this, i);
+        if (!config.cpus.empty()) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(config.cpus[i % config.cpus.size()], &cpus);
+            pthread_setaffinity_np(mWorkers.back().native_handle(), sizeof(cpus), &cpus);
+        }
+    }
+}
+
+JobPool::~JobPool() {
+    waitForBackground();
+    {
+        std::unique_lock<std::mutex> lock{mMutex};
+        mIsStopping = true;
+    }
+    mWakeCondition.notify_all();
+    for (std::thread& worker : mWorkers) {
+        worker.join();
+    }
+}
+
+void JobPool::parallelFor(u32 count, JobFn job, void* ctx) {
+    if (count == 0) {
+        return;
+    }
+    if (count == 1 || mWorkers.empty()) {
+        for (u32 ix = 0; ix < count; ix++) {
+            job(ctx, ix);
+        }
+        return;
+    }
+
+    Batch batch;
+    batch.job = job;
+    batch.ctx = ctx;
+    batch.count = count;
+    const u32 queueIx = getQueueIx();
+    WorkQueue& queue = mQueues[queueIx];
+    const u32 ticketCount = std::min<u32>(count - 1, mWorkers.size());
+    {
+        std::unique_lock<std::mutex> lock{queue.mutex};
+        queue.tickets.insert(queue.tickets.end(), ticketCount, &batch);
+    }
+    mTicketCount.fetch_add(ticketCount, std::memory_order_release);
+    wakeWorkers(ticketCount);
+
+    drain(batch);
+
+    // nobody can pick up the batch after this, so we only have to wait on threads that already did
+    u32 unclaimed;
+    {
+        std::unique_lock<std::mutex> lock{queue.mutex};
+        unclaimed = std::erase(queue.tickets, &batch);
+    }
+    mTicketCount.fetch_sub(unclaimed, std::memory_order_relaxed);
+    while (batch.users.load(std::memory_order_acquire) != 0) {
+        // help instead of blocking, so a worker waiting on a sub-job keeps its core busy
+        if (Batch* other = claimBatch(queueIx)) {
+            drain(*other);
+            other->users.fetch_sub(1, std::memory_order_release);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void JobPool::runInBackground(std::function<void()> job) {
+    if (mWorkers.empty()) {
+        job();
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock{mMutex};
+        mBackgroundJobs.push_back(std::move(job));
+        mBackgroundPending++;
+    }
+    mWakeCondition.notify_one();
+}
+
+void JobPool::waitForBackground() {
+    while (runBackgroundJob()) {
+    }
+    std::unique_lock<std::mutex> lock{mMutex};
+    mBackgroundCondition.wait(lock, [this] { return mBackgroundPending == 0; });
+}
+
+void JobPool::workerLoop(u32 workerIx) {
+    tlPool = this;
+    tlWorkerIx = workerIx;
+    while (true) {
+        if (Batch* batch = claimBatch(workerIx)) {
+            drain(*batch);
+            batch->users.fetch_sub(1, std::memory_order_release);
+            continue;
+        }
+        if (runBackgroundJob()) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock{mMutex};
+        mWakeCondition.wait(lock, [this] {
+            return mIsStopping || mTicketCount.load(std::memory_order_acquire) != 0 || !mBackgroundJobs.empty();
+        });
+        if (mIsStopping) {
+            return;
+        }
+    }
+}
+
+u32 JobPool::getQueueIx() const {
+    return tlPool == this ? tlWorkerIx : mWorkers.size();
+}
+
+// newest ticket from our own queue (most likely a sub-job of what we just ran), otherwise the oldest from the others
+JobPool::Batch* JobPool::claimBatch(u32 queueIx) {
+    if (mTicketCount.load(std::memory_order_acquire) == 0) {
+        return nullptr;
+    }
+    const u32 queueCount = mWorkers.size() + 1;
+    for (u32 i = 0; i < queueCount; i++) {
+        WorkQueue& queue = mQueues[(queueIx + i) % queueCount];
+        std::unique_lock<std::mutex> lock{queue.mutex};
+        if (queue.tickets.empty()) {
+            continue;
+        }
+        Batch* batch;
+        if (i == 0) {
+            batch = queue.tickets.back();
+            queue.tickets.pop_back();
+        } else {
+            batch = queue.tickets.front();
+            queue.tickets.pop_front();
+        }
+        batch->users.fetch_add(1, std::memory_order_relaxed);
+        mTicketCount.fetch_sub(1, std::memory_order_relaxed);
+        return batch;
+    }
+    return nullptr;
+}
+
+bool JobPool::runBackgroundJob() {
+    std::function<void()> job;
+    {
+        std::unique_lock<std::mutex> lock{mMutex};
+        if (mBackgroundJobs.empty()) {
+            return false;
+        }
+        job = std::move(mBackgroundJobs.front());
+        mBackgroundJobs.pop_front();
+    }
+    job();
+    {
+        std::unique_lock<std::mutex> lock{mMutex};
+        mBackgroundPending--;
+    }
+    mBackgroundCondition.notify_all();
+    return true;
+}
+
+void JobPool::wakeWorkers(u32 count) {
+    {
+        // sleeping workers check mTicketCount under this lock, so the wakeup can't slip in before they wait
+        std::unique_lock<std::mutex> lock{mMutex};
+    }
+    if (count == 1) {
+        mWakeCondition.notify_one();
+    } else {
+        mWakeCondition.notify_all();
+    }
+}
+
+void JobPool::drain(Batch& batch) {
+    for (u32 ix = batch.next.fetch_add(1, std::memory_order_relaxed); ix < batch.count; ix = batch.next.fetch_add(1, std::memory_order_relaxed)) {
+        batch.job(batch.ctx, ix);
+    }
+}
+
+}  // namespace whal::ecs
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef uint32_t u32;
+
+namespace whal::ecs {
+
+// Work-stealing fork-join pool. Each worker owns a deque of batches: it pops its own newest work and steals the oldest
+// work from the others. The calling thread always participates, and a thread waiting on a batch runs other batches
+// instead of blocking, so nested parallelFor calls never stall a worker. A pool with zero workers just runs jobs inline
+class JobPool {
+public:
+    using JobFn = void (*)(void* ctx, u32 ix);
+
+    struct Config {
+        u32 workerCount = std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() - 1 : 0;
+        std::vector<u32> cpus;  // worker i is pinned to cpus[i % cpus.size()]. Empty leaves workers unpinned
+    };
+
+    // shared by every world in the process. Uses one worker per hardware thread minus the caller unless configured
+    static JobPool& getInstance();
+    static void configureInstance(const Config& config);  // only valid before the first getInstance
+
+    explicit JobPool(const Config& config);
+    explicit JobPool(u32 workerCount) : JobPool(Config{workerCount, {}}) {}
+    ~JobPool();  // finishes queued background jobs first
+    JobPool(const JobPool&) = delete;
+    void operator=(const JobPool&) = delete;
+
+    // runs job(ctx, ix) for every ix in [0, count) and returns once all of them are done. Safe to call from inside a job
+    void parallelFor(u32 count, JobFn job, void* ctx);
+
+    template <typename F>
+    void parallelFor(u32 count, F& fn) {
+        parallelFor(count, [](void* ctx, u32 ix) { (*static_cast<F*>(ctx))(ix); }, &fn);
+    }
+
+    // low priority. Workers only pick these up when no parallelFor work is queued. Runs inline if there are no workers
+    void runInBackground(std::function<void()> job);
+    void waitForBackground();  // helps until every background job queued so far has finished
+
+    u32 getWorkerCount() const { return mWorkers.size(); }
+
+private:
+    struct Batch {
+        JobFn job;
+        void* ctx;
+        u32 count;
+        std::atomic<u32> next = 0;
+        std::atomic<u32> users = 0;  // threads currently draining this batch. The owner can't return until this hits 0
+    };
+
+    // holds one ticket per thread that may join a batch. Tickets only leave a queue by being claimed or by the owner
+    // taking them back, both under the queue's lock
+    struct alignas(64) WorkQueue {
+        std::mutex mutex;
+        std::deque<Batch*> tickets;
+    };
+
+    void workerLoop(u32 workerIx);
+    u32 getQueueIx() const;  // the calling thread's queue. Threads outside the pool share the last one
+    Batch* claimBatch(u32 queueIx);
+    bool runBackgroundJob();
+    void wakeWorkers(u32 count);
+    static void drain(Batch& batch);
+
+    std::vector<std::thread> mWorkers;
+    std::unique_ptr<WorkQueue[]> mQueues;  // one per worker plus the shared one
+    std::atomic<u32> mTicketCount = 0;
+    std::deque<std::function<void()>> mBackgroundJobs;
+    u32 mBackgroundPending = 0;  // queued or running
+    std::mutex mMutex;  // guards sleeping, stopping and background jobs
+    std::condition_variable mWakeCondition;
+    std::condition_variable mBackgroundCondition;
+    bool mIsStopping = false;
+};
+
+}  // namespace whal::ecs
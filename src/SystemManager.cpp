@@ -5,74 +5,250 @@ namespace whal::ecs {
 void SystemManager::clear() {
     for (SystemBase* sys : mSystems) {
         sys->getEntitiesVirtual().clear();
+        sys->mMembers.clear();
         delete sys;
     }
+    for (StaticScheduleBase* schedule : mStaticSchedules) {
+        delete schedule;
+    }
+    mStaticSchedules.clear();
     mSystemIdToIndex.clear();
     mSystems.clear();
     mUpdateSystems.clear();
+    mUpdateCalls.clear();
     mMonitorSystems.clear();
     mPauseSystems.clear();
     mRenderSystems.clear();
+    mLightRenderSystems.clear();
     mAttributes.clear();
-    mUpdateGroups.clear();
-    mFrame = 0;
+    for (auto& groups : mPhaseGroups) {
+        groups.clear();
+    }
+    rebuildRunLists();
+    mPhaseFrames = {};
+    mRegistrationPhase = Phase::Update;
+    mArchetypeSystems.clear();
+    mDeltas.clear();
     mIsWorldPaused = false;
 }
 
-void SystemManager::autoUpdate() {
-    for (auto& [groupInfo, group] : mUpdateGroups) {
-        // eventually if isParallel then do in parallel RESEARCH
-        if (mFrame % groupInfo.intervalFrame != 0) {
+void SystemManager::runPhase(Phase phase) {
+    const u16 phaseIx = static_cast<u16>(phase);
+    int& frame = mPhaseFrames[phaseIx];
+    const RunList& runList = mRunLists[phaseIx][mIsWorldPaused];
+    for (const RunSegment& segment : runList.segments) {
+        if (segment.intervalFrame != 1 && frame % segment.intervalFrame != 0) {
             continue;
         }
-        for (auto ix : group) {
-            if (mIsWorldPaused && (mAttributes[ix] & UpdateDuringPause) == 0) {
-            } else {
-                mUpdateSystems[ix]->update();
-            }
+        if (segment.isParallel) {
+            auto updateAt = [&](u32 ix) { runList.calls[segment.begin + ix].update(runList.calls[segment.begin + ix].pSystem); };
+            getJobPool().parallelFor(segment.end - segment.begin, updateAt);
+            continue;
+        }
+        for (u32 i = segment.begin; i < segment.end; i++) {
+            runList.calls[i].update(runList.calls[i].pSystem);
         }
     }
-    mFrame++;
+    frame++;
 }
 
-void SystemManager::onEntityDestroyed(const Entity entity) const {
-    // TODO make thread safe
-    for (size_t i = 0; i < mSystems.size(); i++) {
-        const auto& system = mSystems[i];
-        auto const ix = system->getEntitiesVirtual().find(entity.id());
-        if (ix != system->getEntitiesVirtual().end()) {
-            system->getEntitiesVirtual().erase(entity.id());
-            if (mMonitorSystems[i] != nullptr) {
-                mMonitorSystems[i]->onRemove(entity);
+void SystemManager::rebuildRunLists() {
+    for (u16 phaseIx = 0; phaseIx < PHASE_COUNT; phaseIx++) {
+        for (int isPaused = 0; isPaused < 2; isPaused++) {
+            RunList& runList = mRunLists[phaseIx][isPaused];
+            runList.calls.clear();
+            runList.segments.clear();
+            for (auto& [groupInfo, group] : mPhaseGroups[phaseIx]) {
+                const u32 begin = runList.calls.size();
+                if (groupInfo.scheduleCall.update) {
+                    // static schedules check pause attributes themselves
+                    runList.calls.push_back(groupInfo.scheduleCall);
+                }
+                for (auto ix : group) {
+                    if (!isPaused || (mAttributes[ix] & UpdateDuringPause) != 0) {
+                        runList.calls.push_back(mUpdateCalls[ix]);
+                    }
+                }
+                const u32 end = runList.calls.size();
+                if (begin == end) {
+                    continue;
+                }
+
+                // adjacent sequential groups with the same interval collapse into one segment
+                if (!runList.segments.empty()) {
+                    RunSegment& last = runList.segments.back();
+                    if (!last.isParallel && !groupInfo.isParallel && last.intervalFrame == groupInfo.intervalFrame) {
+                        last.end = end;
+                        continue;
+                    }
+                }
+                runList.segments.push_back({begin, end, groupInfo.intervalFrame, groupInfo.isParallel});
             }
         }
     }
 }
 
-void SystemManager::onEntityPatternChanged(const Entity entity, const Pattern& newEntityPattern) const {
-    // TODO make thread safe
-    for (size_t i = 0; i < mSystems.size(); i++) {
-        auto const ix = mSystems[i]->getEntitiesVirtual().find(entity.id());
-        if (mSystems[i]->isPatternInSystem(newEntityPattern)) {
-            if (ix != mSystems[i]->getEntitiesVirtual().end()) {
-                // already in system
-                continue;
+void SystemManager::onEntityActivated(const Entity entity, ArchetypeID archetype) {
+    addToSystems(entity, getMatchingSystems(archetype));
+}
+
+void SystemManager::onEntityDestroyed(const Entity entity, ArchetypeID archetype) {
+    removeFromSystems(entity, getMatchingSystems(archetype));
+}
+
+void SystemManager::onEntityArchetypeChanged(const Entity entity, ArchetypeID from, ArchetypeID to) {
+    const MembershipDelta& delta = getDelta(from, to);
+    removeFromSystems(entity, delta.removed);
+    addToSystems(entity, delta.added);
+}
+
+void SystemManager::onEntitiesChanged(std::span<const ArchetypeChange> changes) {
+    // per system, the changes touching it in batch order. Each op is (change index << 1 | isAdd)
+    const FrameStlAllocator<u32> frame = mWorld.scratchAllocator<u32>();
+    FrameVector<const MembershipDelta*> deltas(changes.size(), frame);
+    FrameVector<FrameVector<u32>> systemOps(mSystems.size(), FrameVector<u32>(frame), frame);
+    for (u32 i = 0; i < changes.size(); i++) {
+        deltas[i] = &getDelta(changes[i].from, changes[i].to);
+        for (u16 system : deltas[i]->removed) {
+            systemOps[system].push_back(i << 1);
+        }
+        for (u16 system : deltas[i]->added) {
+            systemOps[system].push_back(i << 1 | 1);
+        }
+    }
+
+    // each system only touches its own entity set. Whether an op changed anything is recorded for the callbacks
+    FrameVector<FrameVector<bool>> isChanged(mSystems.size(), FrameVector<bool>(frame), frame);
+    auto applyOps = [&](u32 system) {
+        auto& entities = mSystems[system]->getEntitiesVirtual();
+        isChanged[system].resize(systemOps[system].size());
+        for (size_t j = 0; j < systemOps[system].size(); j++) {
+            const u32 op = systemOps[system][j];
+            const Entity entity = changes[op >> 1].entity;
+            if (op & 1) {
+                assert((!((mAttributes[system] & Attributes::UniqueEntity) > 0) || entities.size() < 1 || entities.contains(entity.id())) &&
+                       "Trying to assign more than one entity to system with UniqueEntity attribute");
+                isChanged[system][j] = entities.insert({entity.id(), entity}).second;
+            } else {
+                isChanged[system][j] = entities.erase(entity.id()) != 0;
             }
-            assert((!((mAttributes[i] & Attributes::UniqueEntity) > 0) || mSystems[i]->getEntitiesVirtual().size() < 1) &&
-                   "Trying to assign more than one entity to system with UniqueEntity attribute");
-            mSystems[i]->getEntitiesVirtual().insert({entity.id(), entity});
-            if (mMonitorSystems[i] != nullptr) {
-                mMonitorSystems[i]->onAdd(entity);
+            mSystems[system]->setMember(entity, op & 1);
+        }
+    };
+    if (changes.size() < PARALLEL_MEMBERSHIP_THRESHOLD) {
+        for (u32 system = 0; system < mSystems.size(); system++) {
+            applyOps(system);
+        }
+    } else {
+        getJobPool().parallelFor(mSystems.size(), applyOps);
+    }
+
+    // replay in batch order, so callbacks see the same sequence no matter how the work was split
+    FrameVector<u32> cursor(mSystems.size(), frame);
+    for (u32 i = 0; i < changes.size(); i++) {
+        for (u16 system : deltas[i]->removed) {
+            if (isChanged[system][cursor[system]++] && mMonitorSystems[system] != nullptr) {
+                mMonitorSystems[system]->onRemove(changes[i].entity);
             }
-        } else if (ix != mSystems[i]->getEntitiesVirtual().end()) {
-            if (mMonitorSystems[i] != nullptr) {
-                mMonitorSystems[i]->onRemove(entity);
+        }
+        for (u16 system : deltas[i]->added) {
+            if (isChanged[system][cursor[system]++] && mMonitorSystems[system] != nullptr) {
+                mMonitorSystems[system]->onAdd(changes[i].entity);
             }
-            mSystems[i]->getEntitiesVirtual().erase(entity.id());
         }
     }
 }
 
+void SystemManager::addExistingEntities(u16 system) {
+    // the new system has the highest index, so it's last in every matching list it's in
+    const std::vector<u16> systems = {system};
+    const EntityManager& entityManager = *mWorld.mEntityManager;
+    entityManager.forEachActive([&](Entity entity) {
+        const std::vector<u16>& matching = getMatchingSystems(entityManager.getArchetype(entity));
+        if (!matching.empty() && matching.back() == system) {
+            addToSystems(entity, systems);
+        }
+    });
+}
+
+const std::vector<u16>& SystemManager::getMatchingSystems(ArchetypeID archetype) {
+    static const std::vector<u16> NO_SYSTEMS;
+    if (archetype == INACTIVE) {
+        return NO_SYSTEMS;
+    }
+    if (archetype >= mArchetypeSystems.size()) {
+        mArchetypeSystems.resize(mArchetypes.size());
+    }
+    std::optional<std::vector<u16>>& systems = mArchetypeSystems[archetype];
+    if (!systems) {
+        systems.emplace();
+        const Pattern& pattern = mArchetypes.getPattern(archetype);
+        for (size_t i = 0; i < mSystems.size(); i++) {
+            if (mSystems[i]->isPatternInSystem(pattern)) {
+                systems->push_back(i);
+            }
+        }
+    }
+    return *systems;
+}
+
+const SystemManager::MembershipDelta& SystemManager::getDelta(ArchetypeID from, ArchetypeID to) {
+    const u64 key = (static_cast<u64>(from) << 32) | to;
+    if (auto it = mDeltas.find(key); it != mDeltas.end()) {
+        return it->second;
+    }
+
+    // both lists are sorted by system index
+    const std::vector<u16> fromSystems = getMatchingSystems(from);
+    const std::vector<u16>& toSystems = getMatchingSystems(to);
+    MembershipDelta delta;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < fromSystems.size() || j < toSystems.size()) {
+        if (j == toSystems.size() || (i < fromSystems.size() && fromSystems[i] < toSystems[j])) {
+            delta.removed.push_back(fromSystems[i++]);
+        } else if (i == fromSystems.size() || toSystems[j] < fromSystems[i]) {
+            delta.added.push_back(toSystems[j++]);
+        } else {
+            i++;
+            j++;
+        }
+    }
+    return mDeltas.emplace(key, std::move(delta)).first->second;
+}
+
+void SystemManager::addToSystems(const Entity entity, const std::vector<u16>& systems) {
+    // TODO make thread safe
+    for (u16 i : systems) {
+        auto& entities = mSystems[i]->getEntitiesVirtual();
+        assert((!((mAttributes[i] & Attributes::UniqueEntity) > 0) || entities.size() < 1 || entities.contains(entity.id())) &&
+               "Trying to assign more than one entity to system with UniqueEntity attribute");
+        if (!entities.insert({entity.id(), entity}).second) {
+            continue;
+        }
+        mSystems[i]->setMember(entity, true);
+        if (mMonitorSystems[i] != nullptr) {
+            mMonitorSystems[i]->onAdd(entity);
+        }
+    }
+}
+
+void SystemManager::removeFromSystems(const Entity entity, const std::vector<u16>& systems) {
+    // TODO make thread safe
+    for (u16 i : systems) {
+        auto& entities = mSystems[i]->getEntitiesVirtual();
+        auto const ix = entities.find(entity.id());
+        if (ix == entities.end()) {
+            continue;
+        }
+        if (mMonitorSystems[i] != nullptr) {
+            mMonitorSystems[i]->onRemove(entity);
+        }
+        entities.erase(entity.id());
+        mSystems[i]->setMember(entity, false);
+    }
+}
+
 void SystemManager::onPaused() {
     assert(!mIsWorldPaused);
 
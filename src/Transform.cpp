@@ -0,0 +1,146 @@
+#include "Transform.h"
+
+namespace whal::ecs {
+
+namespace {
+
+constexpr u32 SIBLING_BATCH = 8;
+
+struct TransformArrays {
+    ComponentArray<LocalTransform>* locals;
+    ComponentArray<WorldTransform>* worlds;
+    const EntityManager* entities;
+    const std::vector<u8>* hasDirtyDescendant;
+
+    bool hasTransform(Entity entity) const {
+        return entities->isActive(entity) && locals->hasData(entity) && worlds->hasData(entity);
+    }
+};
+
+// a node whose world transform is known, and whose children still need visiting
+struct PendingParent {
+    Entity entity;
+    bool isDirty;
+};
+
+// composes up to SIBLING_BATCH children with their shared parent. Gathered into separate arrays so the math vectorizes
+void composeSiblings(const Affine2D& parent, LocalTransform* const* locals, WorldTransform* const* worlds, u32 count) {
+    if (count == 0) {
+        return;
+    }
+    // zeroed so the unused lanes of a partial batch compute on defined values
+    float a[SIBLING_BATCH] = {}, b[SIBLING_BATCH] = {}, c[SIBLING_BATCH] = {}, d[SIBLING_BATCH] = {}, tx[SIBLING_BATCH] = {}, ty[SIBLING_BATCH] = {};
+    for (u32 i = 0; i < count; i++) {
+        const Affine2D& local = locals[i]->transform;
+        a[i] = local.a;
+        b[i] = local.b;
+        c[i] = local.c;
+        d[i] = local.d;
+        tx[i] = local.tx;
+        ty[i] = local.ty;
+    }
+    float outA[SIBLING_BATCH], outB[SIBLING_BATCH], outC[SIBLING_BATCH], outD[SIBLING_BATCH], outX[SIBLING_BATCH], outY[SIBLING_BATCH];
+    for (u32 i = 0; i < SIBLING_BATCH; i++) {
+        outA[i] = parent.a * a[i] + parent.c * b[i];
+        outB[i] = parent.b * a[i] + parent.d * b[i];
+        outC[i] = parent.a * c[i] + parent.c * d[i];
+        outD[i] = parent.b * c[i] + parent.d * d[i];
+        outX[i] = parent.a * tx[i] + parent.c * ty[i] + parent.tx;
+        outY[i] = parent.b * tx[i] + parent.d * ty[i] + parent.ty;
+    }
+    for (u32 i = 0; i < count; i++) {
+        worlds[i]->transform = {outA[i], outB[i], outC[i], outD[i], outX[i], outY[i]};
+        locals[i]->isDirty = false;
+    }
+}
+
+// breadth first, so each level only depends on the one above it
+void propagate(const TransformArrays& arrays, Entity root) {
+    thread_local std::vector<PendingParent> current;
+    thread_local std::vector<PendingParent> next;
+    current.clear();
+
+    LocalTransform& rootLocal = arrays.locals->getData(root);
+    const Entity rootParent = arrays.entities->getParent(root);
+    const bool isRootDirty = rootLocal.isDirty;
+    if (isRootDirty) {
+        WorldTransform& rootWorld = arrays.worlds->getData(root);
+        rootWorld.transform = rootParent.isValid() && arrays.worlds->hasData(rootParent)
+                                  ? Affine2D::compose(arrays.worlds->getData(rootParent).transform, rootLocal.transform)
+                                  : rootLocal.transform;
+        rootLocal.isDirty = false;
+    }
+    current.push_back({root, isRootDirty});
+
+    LocalTransform* batchLocals[SIBLING_BATCH];
+    WorldTransform* batchWorlds[SIBLING_BATCH];
+    while (!current.empty()) {
+        next.clear();
+        for (const PendingParent& parent : current) {
+            const Affine2D& parentWorld = arrays.worlds->getData(parent.entity).transform;
+            u32 batchSize = 0;
+            for (Entity child : arrays.entities->getChildren(parent.entity)) {
+                if (!arrays.hasTransform(child)) {
+                    continue;
+                }
+                LocalTransform& local = arrays.locals->getData(child);
+                const bool isDirty = parent.isDirty || local.isDirty;
+                if (isDirty) {
+                    batchLocals[batchSize] = &local;
+                    batchWorlds[batchSize] = &arrays.worlds->getData(child);
+                    if (++batchSize == SIBLING_BATCH) {
+                        composeSiblings(parentWorld, batchLocals, batchWorlds, batchSize);
+                        batchSize = 0;
+                    }
+                }
+                // clean subtrees without dirty descendants are skipped entirely
+                if (isDirty || (*arrays.hasDirtyDescendant)[child.id()]) {
+                    next.push_back({child, isDirty});
+                }
+            }
+            composeSiblings(parentWorld, batchLocals, batchWorlds, batchSize);
+        }
+        std::swap(current, next);
+    }
+}
+
+}  // namespace
+
+void TransformSystem::update() {
+    World& world = getWorld();
+    const TransformArrays arrays = {world.mComponentManager->getOrRegisterArray<LocalTransform>(),
+                                    world.mComponentManager->getOrRegisterArray<WorldTransform>(), world.mEntityManager,
+                                    &mHasDirtyDescendant};
+    mHasDirtyDescendant.resize(world.getCapacity());
+
+    // mark the ancestors of every dirty transform, so the walk knows which clean subtrees it can skip. Scanning the dense
+    // LocalTransform table is a straight walk over the flags, where the entity set would cost a lookup per entity
+    mRoots.clear();
+    arrays.locals->forEach([&](Entity entity, const LocalTransform& local) {
+        if (!local.isDirty || !arrays.hasTransform(entity)) {
+            return;
+        }
+        for (Entity node = entity; node.isValid() && !mHasDirtyDescendant[node.id()]; node = world.mEntityManager->getParent(node)) {
+            mHasDirtyDescendant[node.id()] = 1;
+            mMarked.push_back(node.id());
+        }
+    });
+    for (EntityID id : mMarked) {
+        const Entity node(id);
+        const Entity parent = world.mEntityManager->getParent(node);
+        if (arrays.hasTransform(node) && !(parent.isValid() && arrays.hasTransform(parent))) {
+            mRoots.push_back(node);
+        }
+    }
+
+    // roots don't share any transforms, so each one is its own job
+    auto propagateRoot = [&](u32 ix) { propagate(arrays, mRoots[ix]); };
+    world.getJobPool().parallelFor(mRoots.size(), propagateRoot);
+
+    for (EntityID id : mMarked) {
+        mHasDirtyDescendant[id] = 0;
+    }
+    mMarked.clear();
+}
+
+}  // namespace whal::ecs
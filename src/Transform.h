@@ -0,0 +1,56 @@
+#pragma once
+
+#include "ECS.h"
+
+namespace whal::ecs {
+
+// 2D affine transform, column-major: | a c tx |
+//                                    | b d ty |
+struct Affine2D {
+    float a = 1;
+    float b = 0;
+    float c = 0;
+    float d = 1;
+    float tx = 0;
+    float ty = 0;
+
+    // `parent * child`, so the child's transform is applied first
+    static Affine2D compose(const Affine2D& parent, const Affine2D& child) {
+        return {parent.a * child.a + parent.c * child.b,   parent.b * child.a + parent.d * child.b,
+                parent.a * child.c + parent.c * child.d,   parent.b * child.c + parent.d * child.d,
+                parent.a * child.tx + parent.c * child.ty + parent.tx, parent.b * child.tx + parent.d * child.ty + parent.ty};
+    }
+};
+
+// Transform relative to the parent entity. Replacing it with `entity.set` or changing it through `set` marks it dirty;
+// anything else that should move the entity (like reparenting) needs `isDirty = true`
+struct LocalTransform {
+    Affine2D transform;
+    bool isDirty = true;
+
+    void set(const Affine2D& newTransform) {
+        transform = newTransform;
+        isDirty = true;
+    }
+};
+
+// Transform relative to the world, written by TransformSystem
+struct WorldTransform {
+    Affine2D transform;
+};
+
+// Optional system which computes every WorldTransform from the LocalTransforms along its hierarchy. Entities whose
+// parent has no transform are roots. Only subtrees containing a dirty LocalTransform are walked, and independent roots
+// are processed in parallel.
+// Usage: `world.BeginSystemRegistration().phase(Phase::PostUpdate).sequential<TransformSystem>();`
+class TransformSystem : public ISystem<LocalTransform, WorldTransform>, public IUpdate {
+public:
+    void update() override;
+
+private:
+    std::vector<u8> mHasDirtyDescendant;  // per entity ID, only set during update
+    std::vector<EntityID> mMarked;
+    std::vector<Entity> mRoots;
+};
+
+}  // namespace whal::ecs
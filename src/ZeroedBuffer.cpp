@@ -0,0 +1,102 @@
+#include "ZeroedBuffer.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+namespace whal::ecs {
+
+ZeroedBuffer::ZeroedBuffer(size_t bytes) : mSize(bytes) {
+    // anonymous mappings read as zero and only get physical pages once written
+    mData = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    assert(mData != MAP_FAILED && "Failed to map component storage");
+}
+
+ZeroedBuffer::ZeroedBuffer(size_t bytes, std::string path) : mSize(bytes), mPath(std::move(path)) {
+    // a freshly truncated file is sparse, so it reads as zero and only takes disk space once written
+    mFile = open(mPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (mFile == -1) {
+        fallBackToMemory("open");
+        return;
+    }
+    if (ftruncate(mFile, bytes) != 0) {
+        fallBackToMemory("ftruncate");
+        return;
+    }
+    mData = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, mFile, 0);
+    if (mData == MAP_FAILED) {
+        fallBackToMemory("mmap");
+    }
+}
+
+void ZeroedBuffer::fallBackToMemory(const char* step) {
+    mError = mPath + ": " + step + " failed: " + std::strerror(errno);
+    if (mFile != -1) {
+        close(mFile);
+        unlink(mPath.c_str());
+        mFile = -1;
+    }
+    mData = mmap(nullptr, mSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    assert(mData != MAP_FAILED && "Failed to map component storage");
+}
+
+ZeroedBuffer::~ZeroedBuffer() {
+    munmap(mData, mSize);
+    if (mFile != -1) {
+        close(mFile);
+        unlink(mPath.c_str());
+    }
+}
+
+static size_t pageSize() {
+    static const size_t PAGE_SIZE = sysconf(_SC_PAGESIZE);
+    return PAGE_SIZE;
+}
+
+void ZeroedBuffer::commit(size_t bytes) {
+    bytes = bytes < mSize ? bytes : mSize;
+
+    // a write is needed to get a private page, but it must not clobber anything that's already there
+    volatile char* bytesPtr = static_cast<char*>(mData);
+    for (size_t offset = 0; offset < bytes; offset += pageSize()) {
+        bytesPtr[offset] = bytesPtr[offset];
+    }
+}
+
+void ZeroedBuffer::release(size_t offset, size_t bytes) {
+    const size_t PAGE_SIZE = pageSize();
+    offset = offset < mSize ? offset : mSize;
+    bytes = bytes < mSize - offset ? bytes : mSize - offset;
+    char* bytesPtr = static_cast<char*>(mData);
+
+    // MADV_DONTNEED on a private anonymous mapping drops the pages, so they read as zero again. Shared file pages
+    // would just be read back, so the file gets a hole punched instead. Partial pages at either end are cleared by hand
+    const size_t pagesBegin = (offset + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+    const size_t pagesEnd = (offset + bytes) / PAGE_SIZE * PAGE_SIZE;
+    if (pagesBegin >= pagesEnd) {
+        std::memset(bytesPtr + offset, 0, bytes);
+        return;
+    }
+    if (mFile == -1) {
+        madvise(bytesPtr + pagesBegin, pagesEnd - pagesBegin, MADV_DONTNEED);
+    } else if (fallocate(mFile, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, pagesBegin, pagesEnd - pagesBegin) != 0) {
+        std::memset(bytesPtr + pagesBegin, 0, pagesEnd - pagesBegin);  // filesystem can't punch holes
+    }
+    std::memset(bytesPtr + offset, 0, pagesBegin - offset);
+    std::memset(bytesPtr + pagesEnd, 0, offset + bytes - pagesEnd);
+}
+
+void ZeroedBuffer::flush() {
+    if (mFile != -1) {
+        msync(mData, mSize, MS_SYNC);
+    }
+}
+
+void ZeroedBuffer::adviseSequential(bool isSequential) {
+    madvise(mData, mSize, isSequential ? MADV_SEQUENTIAL : MADV_NORMAL);
+}
+
+}  // namespace whal::ecs
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace whal::ecs {
+
+// Fixed-size block of zero-initialized memory. Pages are backed by the OS zero page until they're first written, so a
+// large buffer costs nothing until it's used, and release() hands touched pages back and zeroes them again.
+// A buffer can also be backed by a (sparse) file, so it can be larger than RAM. The file is deleted with the buffer. If
+// the file can't be created or mapped, the buffer falls back to anonymous memory and `getError` says why
+class ZeroedBuffer {
+public:
+    explicit ZeroedBuffer(size_t bytes);
+    ZeroedBuffer(size_t bytes, std::string path);
+    ~ZeroedBuffer();
+    ZeroedBuffer(const ZeroedBuffer&) = delete;
+    void operator=(const ZeroedBuffer&) = delete;
+
+    void* data() const { return mData; }
+    size_t size() const { return mSize; }
+    const std::string& getError() const { return mError; }  // empty unless a file-backed buffer fell back to memory
+
+    // backs [0, bytes) with real pages now instead of on first write
+    void commit(size_t bytes);
+
+    // zeroes [offset, offset + bytes), returning the whole pages inside it to the OS
+    void release(size_t offset, size_t bytes);
+    void release(size_t bytes) { release(0, bytes); }
+    void release() { release(0, mSize); }
+
+    // file-backed buffers only: writes dirty pages back to the file, so the OS can evict them without waiting on IO
+    void flush();
+
+    // hints that the buffer is about to be read front to back (read ahead, drop pages behind) or randomly
+    void adviseSequential(bool isSequential);
+
+private:
+    void fallBackToMemory(const char* step);
+
+    void* mData;
+    size_t mSize;
+    int mFile = -1;
+    std::string mPath;
+    std::string mError;
+};
+
+}  // namespace whal::ecs